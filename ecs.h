@@ -1,6 +1,8 @@
 #ifndef _ECS_H_
 #define _ECS_H_
 
+#include <stddef.h>
+
 #define ECS_API
 #define ECS_VERSION "0.1.0"
 
@@ -19,22 +21,110 @@
 #define ECS_STATE_ENABLED 0x1
 #define ECS_STATE_LOADED 0x2
 
+// Components per storage chunk, chunks are the unit of copy-on-write
+#ifndef ECS_CHUNK_SHIFT
+    #define ECS_CHUNK_SHIFT 6
+#endif
+#define ECS_CHUNK_SIZE (1 << ECS_CHUNK_SHIFT)
+
+// Entity ids each thread keeps reserved, see ecs_create_entity
+#ifndef ECS_ENTITY_CACHE
+    #define ECS_ENTITY_CACHE 32
+#endif
+
+// Threads that can keep a cache in one world, the rest share the free list
+#ifndef ECS_ENTITY_CACHES
+    #define ECS_ENTITY_CACHES 16
+#endif
+
+#define ECS_PHASE_PRE_UPDATE 0
+#define ECS_PHASE_FIXED_UPDATE 1
+#define ECS_PHASE_UPDATE 2
+#define ECS_PHASE_POST_UPDATE 3
+#define ECS_PHASE_RENDER 4
+#define ECS_PHASE_COUNT 5
+
+// Upper bound of fixed steps per ecs_progress, avoids the spiral of death
+#ifndef ECS_MAX_FIXED_STEPS
+    #define ECS_MAX_FIXED_STEPS 8
+#endif
+
+#define ECS_EVENT_ADD 0x1
+#define ECS_EVENT_REMOVE 0x2
+#define ECS_EVENT_SET 0x4
+
+#define ECS_COMPACT_ARCHETYPE 0x1
+#define ECS_COMPACT_SHRINK 0x2
+
 #define ECS_MASK(count, ...) \
 count, (int[]){__VA_ARGS__}
 
+#define ECS_FIELD(type, member, group) \
+{ offsetof(type, member), sizeof(((type*)0)->member), group }
+
+#define ECS_FIELDS(count, ...) \
+count, (ecs_field_t[]){__VA_ARGS__}
+
 typedef unsigned int ecs_entity_t;
 
 typedef struct ecs_world_t ecs_world_t;
+typedef struct ecs_snapshot_t ecs_snapshot_t;
+
+typedef struct {
+    char enabled;
+    char prefab;
+    unsigned int mask;
+    int* components;
+} ecs_entity_internal_t;
+
+// Fields that share a group are stored interleaved, each group gets its own
+// array, so one field per group is plain SoA
+typedef struct {
+    int offset;
+    int size;
+    int group;
+} ecs_field_t;
 
 typedef struct {
     unsigned int mask;
     ecs_world_t* world;
+    float delta;
     int entities_count;
     ecs_entity_t* entities;
 } ecs_filter_t;
 
 typedef void(*ecs_system_func_t)(ecs_filter_t*);
 
+// REMOVE events carry a copy of the component as it was removed in data,
+// NULL for the other events. The entity may have been destroyed and its id
+// reused by the time the event is delivered, so data is the only safe way
+// to see what was removed. It stays valid until the queue is flushed or
+// cleared, and is NULL when the component's chunk could not be paged in
+typedef struct {
+    int type;
+    int component;
+    ecs_entity_t entity;
+    const void* data;
+} ecs_event_t;
+
+typedef struct {
+    ecs_world_t* world;
+    int observer;
+    int events_count;
+    ecs_event_t* events;
+} ecs_event_queue_t;
+
+typedef void(*ecs_observer_func_t)(ecs_event_queue_t*);
+
+typedef struct {
+    int component;
+    int chunk;
+    unsigned int last_use;
+} ecs_page_t;
+
+// Returns the index in pages of the next chunk to evict
+typedef int(*ecs_evict_func_t)(ecs_world_t* w, ecs_page_t* pages, int count);
+
 #if defined(__cplusplus)
 extern "C" {
 #endif
@@ -48,21 +138,106 @@ ECS_API void ecs_clear_components(ecs_world_t* w);
 ECS_API void ecs_clear_systems(ecs_world_t* w);
 
 ECS_API void ecs_update(ecs_world_t* w);
-// ECS_API void ecs_run_systems(ecs_world_t* w, int type);
+ECS_API void ecs_progress(ecs_world_t* w, float delta);
+ECS_API void ecs_run_systems(ecs_world_t* w, int phase, float delta);
+ECS_API void ecs_set_fixed_timestep(ecs_world_t* w, float step);
 
 ECS_API void ecs_register_component(ecs_world_t* w, int index, unsigned int size, unsigned int count);
+ECS_API void ecs_register_component_fields(ecs_world_t* w, int index, unsigned int count, int field_count, ecs_field_t fields[]);
 ECS_API void ecs_unregister_component(ecs_world_t* w, int index);
 
 ECS_API void ecs_register_system(ecs_world_t* w, ecs_system_func_t fn, int filter_count, int filters[]);
 ECS_API void ecs_unregister_system(ecs_world_t* w, ecs_system_func_t fn);
-
+ECS_API void ecs_system_set_phase(ecs_world_t* w, ecs_system_func_t fn, int phase);
+ECS_API void ecs_system_set_interval(ecs_world_t* w, ecs_system_func_t fn, int ticks);
+
+// Queries keep a filter up to date the way systems do, for code that walks
+// matching entities on its own schedule. Registering a query can move the
+// filters of the others, look them up again instead of keeping the pointer
+ECS_API int ecs_register_query(ecs_world_t* w, int filter_count, int filters[]);
+ECS_API void ecs_unregister_query(ecs_world_t* w, int query);
+ECS_API ecs_filter_t* ecs_query_filter(ecs_world_t* w, int query);
+
+// Observers with a NULL fn are polled through ecs_observer_queue instead
+ECS_API int ecs_register_observer(ecs_world_t* w, int events, ecs_observer_func_t fn, int filter_count, int filters[]);
+ECS_API void ecs_unregister_observer(ecs_world_t* w, int observer);
+ECS_API ecs_event_queue_t* ecs_observer_queue(ecs_world_t* w, int observer);
+ECS_API void ecs_observer_clear(ecs_world_t* w, int observer);
+ECS_API void ecs_flush_observers(ecs_world_t* w);
+
+// ecs_create_entity and the deferred calls are safe to call from any
+// thread; everything else belongs to the thread that updates the world.
+// New entities join system filters at the next ecs_sync, which ecs_update
+// runs first
 ECS_API ecs_entity_t ecs_create_entity(ecs_world_t* w);
 ECS_API void ecs_destroy_entity(ecs_world_t* w, ecs_entity_t e);
-
-ECS_API void ecs_entity_set_component(ecs_world_t* w, ecs_entity_t e, int comp, void* data);
+ECS_API void ecs_destroy_entity_deferred(ecs_world_t* w, ecs_entity_t e);
+// data is copied right away and set at the next ecs_sync, in the order the
+// sets were queued and before deferred destroys. Sets on entities that are
+// gone by then, or that find the pool full, are dropped
+ECS_API void ecs_entity_set_component_deferred(ecs_world_t* w, ecs_entity_t e, int comp, const void* data);
+
+// Prefabs are skipped by systems, queries and observers, their instances
+// share the prefab's components until one of them asks for a writable
+// pointer. The private copy needs a free slot; when the pool has none, set
+// returns 0 and the get functions return NULL, leaving the shared value
+// untouched
+ECS_API ecs_entity_t ecs_create_prefab(ecs_world_t* w);
+ECS_API int ecs_instantiate(ecs_world_t* w, ecs_entity_t prefab, int count, ecs_entity_t* out);
+ECS_API void ecs_sync(ecs_world_t* w);
+// Hands back the ids the calling thread has reserved, for threads that are
+// done creating entities in w
+ECS_API void ecs_flush_entity_cache(ecs_world_t* w);
+
+ECS_API int ecs_entity_set_component(ecs_world_t* w, ecs_entity_t e, int comp, void* data);
 ECS_API void* ecs_entity_get_component(ecs_world_t* w, ecs_entity_t e, int comp);
+ECS_API const void* ecs_entity_read_component(ecs_world_t* w, ecs_entity_t e, int comp);
 ECS_API void ecs_entity_remove_component(ecs_world_t* w, ecs_entity_t e, int comp);
 
+// Components registered with fields have no contiguous struct to point at,
+// ecs_entity_get_component returns NULL for them, use these instead
+ECS_API void* ecs_entity_get_field(ecs_world_t* w, ecs_entity_t e, int comp, int field);
+ECS_API int ecs_entity_copy_component(ecs_world_t* w, ecs_entity_t e, int comp, void* out);
+
+// Packs live components into dense runs, looking at budget entities per
+// call (all of them when budget is 0), returns 1 once the pass is done.
+// Prefab slots have several referrers and stay where they are
+ECS_API int ecs_compact(ecs_world_t* w, int budget, int flags);
+
+// Evicted chunks are faulted back in on access, eviction itself only
+// happens in ecs_evict, so pointers stay valid until the next update.
+// Snapshots of a paged world must be freed before the world is destroyed
+ECS_API int ecs_set_paging(ecs_world_t* w, const char* path, int max_resident, ecs_evict_func_t policy);
+// A chunk that can't be read back stays evicted, the access that needed it
+// fails (NULL or 0) and the world remembers the error until this is called
+ECS_API int ecs_paging_error(ecs_world_t* w);
+ECS_API void ecs_evict(ecs_world_t* w);
+ECS_API void ecs_evict_chunk(ecs_world_t* w, int comp, int chunk);
+ECS_API void ecs_prefetch(ecs_world_t* w, ecs_entity_t e);
+ECS_API void ecs_prefetch_chunk(ecs_world_t* w, int comp, int chunk);
+
+ECS_API ecs_snapshot_t* ecs_world_clone(ecs_world_t* w);
+ECS_API void ecs_world_restore(ecs_world_t* w, ecs_snapshot_t* s);
+ECS_API void ecs_snapshot_free(ecs_snapshot_t* s);
+
+// Raw storage access, used by ecs.hpp to build typed loops
+ECS_API ecs_entity_internal_t* ecs_entities(ecs_world_t* w, int* count);
+ECS_API int ecs_component_chunk_count(ecs_world_t* w, int comp);
+ECS_API int ecs_component_field_count(ecs_world_t* w, int comp);
+// A slot is in use while its share count is above zero. Chunks can hold
+// stale data in free slots, so field loops should skip empty chunks and
+// check shares; after a full ecs_compact the live slots of a chunk are
+// its first ones, prefab slots aside.
+// A share count above one is a prefab's value seen by all its instances.
+// Writable chunks are only unshared from snapshots, writing such a slot in
+// place changes the prefab and every instance, so loops that mean to
+// change one entity skip those slots and write through
+// ecs_entity_get_field, which gives that entity a copy of its own
+ECS_API const int* ecs_component_shares(ecs_world_t* w, int comp);
+ECS_API int ecs_component_chunk_live(ecs_world_t* w, int comp, int chunk);
+ECS_API void* ecs_component_chunk(ecs_world_t* w, int comp, int chunk, int write);
+ECS_API void* ecs_component_field(ecs_world_t* w, int comp, int chunk, int field, int* stride, int write);
+
 #if defined(__cplusplus)
 }
 #endif
@@ -74,6 +249,13 @@ ECS_API void ecs_entity_remove_component(ecs_world_t* w, ecs_entity_t e, int com
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdatomic.h>
+
+#define ECS_ENTITY_ALIVE 0x1
+#define ECS_ENTITY_PENDING 0x2
+#define ECS_ENTITY_CREATED 0x4
+// Counts the deferred sets queued for the entity, from this bit up
+#define ECS_ENTITY_SET 0x10
 
 typedef struct {
     int top;
@@ -106,25 +288,225 @@ static int stack_pop(stack_t* s) {
     return res;
 }
 
+static void stack_copy(stack_t* dst, stack_t* src) {
+    stack_init(dst, src->size);
+    dst->top = src->top;
+    if (src->size) memcpy(dst->data, src->data, sizeof(int) * src->size);
+}
 
+// Snapshots copy bookkeeping arrays a chunk at a time, and every snapshot
+// taken while a chunk goes unwritten shares the same copy of it
 typedef struct {
-    char enabled;
-    unsigned int mask;
-    int* components;
-} ecs_entity_internal_t;
+    int refs;
+    char data[];
+} ecs_meta_chunk_t;
+
+#define ECS_META_COLUMNS 3
+
+// Parallel arrays of count elements, the live arrays stay flat and each
+// copy holds one chunk of every column
+typedef struct {
+    int count;
+    int chunk_count;
+    int columns;
+    char* bases[ECS_META_COLUMNS];
+    int sizes[ECS_META_COLUMNS];
+    int chunk_bytes;
+    // The copy each chunk still matches, NULL once it has been written to
+    ecs_meta_chunk_t** clean;
+} ecs_meta_t;
+
+static void meta_chunk_release(ecs_meta_chunk_t* chunk) {
+    if (chunk && --chunk->refs == 0) ECS_FREE(chunk);
+}
+
+static void meta_touch(ecs_meta_t* m, int index) {
+    ecs_meta_chunk_t** clean = &(m->clean[index >> ECS_CHUNK_SHIFT]);
+    if (!*clean) return;
+    meta_chunk_release(*clean);
+    *clean = NULL;
+}
+
+static void meta_touch_all(ecs_meta_t* m) {
+    for (int c = 0; c < m->chunk_count; c++) {
+        meta_chunk_release(m->clean[c]);
+        m->clean[c] = NULL;
+    }
+}
+
+static void meta_deinit(ecs_meta_t* m) {
+    meta_touch_all(m);
+    ECS_FREE(m->clean);
+    m->clean = NULL;
+    m->chunk_count = 0;
+}
+
+static void meta_init(ecs_meta_t* m, int count, int columns, void** bases, int* sizes) {
+    meta_deinit(m);
+    m->count = count;
+    m->columns = columns;
+    m->chunk_bytes = 0;
+    for (int i = 0; i < columns; i++) {
+        m->bases[i] = bases[i];
+        m->sizes[i] = sizes[i];
+        m->chunk_bytes += sizes[i] * ECS_CHUNK_SIZE;
+    }
+    m->chunk_count = (count + ECS_CHUNK_SIZE - 1) >> ECS_CHUNK_SHIFT;
+    m->clean = ECS_MALLOC(sizeof(ecs_meta_chunk_t*) * m->chunk_count);
+    memset(m->clean, 0, sizeof(ecs_meta_chunk_t*) * m->chunk_count);
+}
+
+static void meta_copy(ecs_meta_t* m, int c, char* data, int restore) {
+    int first = c << ECS_CHUNK_SHIFT;
+    int n = m->count - first < ECS_CHUNK_SIZE ? m->count - first : ECS_CHUNK_SIZE;
+    for (int i = 0; i < m->columns; i++) {
+        char* live = m->bases[i] + (first * m->sizes[i]);
+        if (restore) memcpy(live, data, n * m->sizes[i]);
+        else memcpy(data, live, n * m->sizes[i]);
+        data += m->sizes[i] * ECS_CHUNK_SIZE;
+    }
+}
+
+// Returns a ref to every chunk, only chunks written since the last clone
+// are copied
+static ecs_meta_chunk_t** meta_clone(ecs_meta_t* m) {
+    ecs_meta_chunk_t** chunks = ECS_MALLOC(sizeof(ecs_meta_chunk_t*) * m->chunk_count);
+    for (int c = 0; c < m->chunk_count; c++) {
+        if (!m->clean[c]) {
+            ecs_meta_chunk_t* chunk = ECS_MALLOC(sizeof(*chunk) + m->chunk_bytes);
+            chunk->refs = 1;
+            meta_copy(m, c, chunk->data, 0);
+            m->clean[c] = chunk;
+        }
+        chunks[c] = m->clean[c];
+        chunks[c]->refs++;
+    }
+    return chunks;
+}
+
+static void meta_restore(ecs_meta_t* m, ecs_meta_chunk_t** chunks) {
+    for (int c = 0; c < m->chunk_count; c++) {
+        // Chunks untouched since the snapshot already hold its data
+        if (m->clean[c] == chunks[c]) continue;
+        meta_copy(m, c, chunks[c]->data, 1);
+        meta_chunk_release(m->clean[c]);
+        m->clean[c] = chunks[c];
+        chunks[c]->refs++;
+    }
+}
+
+static void meta_free(ecs_meta_chunk_t** chunks, int count) {
+    for (int c = 0; c < count; c++) meta_chunk_release(chunks[c]);
+    ECS_FREE(chunks);
+}
+
+typedef struct {
+    _Atomic(void*) owner;
+    int count;
+    int ids[ECS_ENTITY_CACHE];
+} ecs_entity_cache_t;
+
+typedef struct ecs_command_t {
+    struct ecs_command_t* next;
+    ecs_entity_t entity;
+    int component;
+    int size;
+    char data[];
+} ecs_command_t;
 
 typedef struct {
     int count;
     ecs_entity_internal_t* entities;
-    stack_t available;
+    // The component slots of every entity in one block, entity i's at
+    // components + i * component count
+    int* components;
+    // Covers entities and components
+    ecs_meta_t meta;
+    // Ids are handed out fresh from 'fresh' and recycled through a tagged
+    // lock-free stack linked by 'free_next'
+    _Atomic int fresh;
+    _Atomic unsigned long long free_head;
+    _Atomic int* free_next;
+    // An id is only recycled once it is dead and out of every queue
+    _Atomic int* flags;
+    _Atomic int pending_head;
+    int* pending_next;
+    _Atomic int created_head;
+    int* created_next;
+    // Deferred sets, newest first
+    _Atomic(ecs_command_t*) commands;
+    ecs_entity_cache_t caches[ECS_ENTITY_CACHES];
 } ecs_entity_manager_t;
 
+typedef struct ecs_pager_t ecs_pager_t;
+
+typedef struct ecs_chunk_t {
+    int refs;
+    char dirty;
+    char listed;
+    int bytes;
+    long offset;
+    unsigned int stamp;
+    int component;
+    int index;
+    void* data;
+    ecs_pager_t* pager;
+    struct ecs_chunk_t* prev;
+    struct ecs_chunk_t* next;
+} ecs_chunk_t;
+
+typedef struct {
+    long offset;
+    int bytes;
+} ecs_file_slot_t;
+
+struct ecs_pager_t {
+    FILE* file;
+    long end;
+    int max_resident;
+    int resident;
+    unsigned int clock;
+    int error;
+    ecs_evict_func_t policy;
+    // Resident chunks, most recently used at the head
+    ecs_chunk_t* head;
+    ecs_chunk_t* tail;
+    // File space of released chunks, reused by the next chunk of that size
+    int slot_count;
+    int slot_capacity;
+    ecs_file_slot_t* slots;
+    int page_capacity;
+    ecs_page_t* pages;
+    ecs_chunk_t** page_chunks;
+};
+
+typedef struct {
+    int offset;
+    int size;
+    int base;
+    int inner;
+    int stride;
+} ecs_field_layout_t;
+
 typedef struct {
     char state;
+    int index;
     int size;
     int count;
     stack_t available;
-    void* data;
+    // Where each free slot sits in available, -1 for slots in use
+    int* free_at;
+    int* owners;
+    int* shares;
+    // Covers owners, shares and the available stack
+    ecs_meta_t meta;
+    int* live;
+    ecs_pager_t* pager;
+    int chunk_bytes;
+    int field_count;
+    ecs_field_layout_t* fields;
+    int chunk_count;
+    ecs_chunk_t** chunks;
 } ecs_component_pool_t;
 
 typedef struct {
@@ -138,7 +520,11 @@ typedef struct {
     char enabled;
     unsigned int mask;
     ecs_system_func_t func;
-    stack_t entities;
+    int phase;
+    int interval;
+    int ticks;
+    float elapsed;
+    ecs_filter_t filter;
 } ecs_system_t;
 
 typedef struct {
@@ -147,329 +533,1158 @@ typedef struct {
     stack_t available_systems;
 } ecs_system_manager_t;
 
+typedef struct {
+    char enabled;
+    int events;
+    unsigned int mask;
+    ecs_observer_func_t func;
+    int capacity;
+    ecs_event_queue_t queue;
+    // Copies of removed components, pointed at by queued REMOVE events
+    char* removed;
+    int removed_size;
+    int removed_capacity;
+} ecs_observer_t;
+
+typedef struct {
+    int count;
+    ecs_observer_t* observers;
+} ecs_observer_manager_t;
+
+typedef struct {
+    char enabled;
+    ecs_filter_t filter;
+} ecs_query_t;
+
+typedef struct {
+    int count;
+    ecs_query_t* queries;
+} ecs_query_manager_t;
+
+typedef struct {
+    char active;
+    int flags;
+    int cursor;
+    int order_count;
+    int* order;
+    int* next;
+} ecs_compactor_t;
+
 struct ecs_world_t {
+    unsigned int serial;
     ecs_entity_manager_t entity_manager;
     ecs_component_manager_t component_manager;
     ecs_system_manager_t system_manager;
+    ecs_observer_manager_t observer_manager;
+    ecs_query_manager_t query_manager;
+    ecs_compactor_t compactor;
+    ecs_pager_t pager;
+
+    float fixed_step;
+    float accumulator;
 
     int max_entities;
     int max_components;
     int max_systems;
+};
 
-    int entity_top;
-    int system_top;
+static void chunk_link(ecs_pager_t* pager, ecs_chunk_t* chunk) {
+    chunk->prev = NULL;
+    chunk->next = pager->head;
+    if (pager->head) pager->head->prev = chunk;
+    else pager->tail = chunk;
+    pager->head = chunk;
+    chunk->listed = 1;
+    pager->resident++;
+}
 
-    ecs_entity_internal_t* entities;
-    ecs_component_pool_t* components;
-    ecs_system_t* systems;
+static void chunk_unlink(ecs_pager_t* pager, ecs_chunk_t* chunk) {
+    if (!chunk->listed) return;
+    if (chunk->prev) chunk->prev->next = chunk->next;
+    else pager->head = chunk->next;
+    if (chunk->next) chunk->next->prev = chunk->prev;
+    else pager->tail = chunk->prev;
+    chunk->prev = chunk->next = NULL;
+    chunk->listed = 0;
+    pager->resident--;
+}
 
-    ecs_filter_t filter;
-};
+// Only paged worlds keep the list, ecs_evict takes chunks from its tail
+static void chunk_touch(ecs_pager_t* pager, ecs_chunk_t* chunk) {
+    chunk->stamp = pager->clock;
+    if (!pager->file || pager->head == chunk) return;
+    chunk_unlink(pager, chunk);
+    chunk_link(pager, chunk);
+}
 
-static void update_filters(ecs_world_t* w, int comp) {
-    for (int i = 0; i < w->system_top; i++) {
-        ecs_system_t* sys = &(w->systems[i]);
-        ecs_filter_t* filter = &(sys->filter);
-        filter->world = w;
-        if (!(sys->mask & (1 << comp))) continue;
-        sys->filter.entities_count = 0;
-        for (int e = 0; e < w->entity_top; e++) {
-            ecs_entity_internal_t* ent = &(w->entities[e]);
-            if (ent->enabled && ((ent->mask & sys->mask) == sys->mask)) {
-                filter->entities[filter->entities_count++] = (e+1);
-            }
+static long pager_alloc(ecs_pager_t* pager, int bytes) {
+    for (int i = 0; i < pager->slot_count; i++) {
+        if (pager->slots[i].bytes != bytes) continue;
+        long offset = pager->slots[i].offset;
+        pager->slots[i] = pager->slots[--pager->slot_count];
+        return offset;
+    }
+    long offset = pager->end;
+    pager->end += bytes;
+    return offset;
+}
+
+static void pager_free(ecs_pager_t* pager, long offset, int bytes) {
+    if (pager->slot_count >= pager->slot_capacity) {
+        pager->slot_capacity = pager->slot_capacity ? pager->slot_capacity * 2 : 16;
+        pager->slots = ECS_REALLOC(pager->slots, sizeof(ecs_file_slot_t) * pager->slot_capacity);
+    }
+    pager->slots[pager->slot_count].offset = offset;
+    pager->slots[pager->slot_count].bytes = bytes;
+    pager->slot_count++;
+}
+
+static void* chunk_fetch(ecs_pager_t* pager, ecs_chunk_t* chunk) {
+    if (!chunk->data) {
+        void* data = ECS_MALLOC(chunk->bytes);
+        if (fseek(pager->file, chunk->offset, SEEK_SET) != 0 ||
+            fread(data, 1, chunk->bytes, pager->file) != (size_t)chunk->bytes) {
+            // Leave the chunk evicted, its copy on disk is all there is
+            ECS_FREE(data);
+            pager->error = 1;
+            return NULL;
         }
+        chunk->data = data;
+        chunk->dirty = 0;
     }
+    chunk_touch(pager, chunk);
+    return chunk->data;
 }
 
-ecs_world_t* ecs_create(int entities, int components, int systems) {
-    ecs_world_t* world = ECS_MALLOC(sizeof(*world));
-    if (!world) return world;
-    memset(world, 0, sizeof(*world));
-    world->max_entities = entities;
-    world->max_components = components;
-    world->max_systems = systems;
+static void chunk_evict(ecs_pager_t* pager, ecs_chunk_t* chunk) {
+    if (!chunk || !chunk->data || !pager->file) return;
+    if (chunk->offset < 0) chunk->offset = pager_alloc(pager, chunk->bytes);
+    // Clean chunks already match their copy on disk
+    if (chunk->dirty) {
+        if (fseek(pager->file, chunk->offset, SEEK_SET) != 0 ||
+            fwrite(chunk->data, 1, chunk->bytes, pager->file) != (size_t)chunk->bytes) return;
+    }
+    ECS_FREE(chunk->data);
+    chunk->data = NULL;
+    chunk->dirty = 0;
+    chunk_unlink(pager, chunk);
+}
 
-    ecs_entity_manager_t* em = &(world->entity_manager);
-    ecs_component_manager_t* cm = &(world->component_manager);
-    ecs_system_manager_t* sm = &(world->system_manager);
+static void chunk_release(ecs_chunk_t* chunk) {
+    if (!chunk || --chunk->refs > 0) return;
+    // The list entry and file space are only there when the world pages
+    chunk_unlink(chunk->pager, chunk);
+    if (chunk->offset >= 0) pager_free(chunk->pager, chunk->offset, chunk->bytes);
+    ECS_FREE(chunk->data);
+    ECS_FREE(chunk);
+}
 
-    // Entity Manager
-    em->count = entities;
-    int size = sizeof(ecs_entity_internal_t) * entities; 
-    em->entities = malloc(size);
-    memset(em->entities, 0, size);
-    stack_init(&(ee->available), entities);
-    ee->available.top = entities;
+static ecs_chunk_t* chunk_create(ecs_component_pool_t* pool, int c) {
+    ecs_chunk_t* chunk = ECS_MALLOC(sizeof(*chunk));
+    memset(chunk, 0, sizeof(*chunk));
+    chunk->refs = 1;
+    chunk->dirty = 1;
+    chunk->bytes = pool->chunk_bytes;
+    chunk->offset = -1;
+    chunk->component = pool->index;
+    chunk->index = c;
+    chunk->pager = pool->pager;
+    chunk->data = ECS_MALLOC(chunk->bytes);
+    memset(chunk->data, 0, chunk->bytes);
+    chunk_touch(chunk->pager, chunk);
+    return chunk;
+}
 
-    for (int i = 0; i < entities; i++) {
-        ecs_entity_internal_t* ee = &(em->entities[i]);
-        ee->enabled = 0;
-        ee->mask = 0;
-        ee->components = ECS_MALLOC(sizeof(int) * components);
-        ee->available.data[i] = entities - i;
-    }
+static void pool_release(ecs_component_pool_t* pool) {
+    for (int i = 0; i < pool->chunk_count; i++) chunk_release(pool->chunks[i]);
+    ECS_FREE(pool->chunks);
+    pool->chunks = NULL;
+    pool->chunk_count = 0;
+}
 
-    // Component Manager
-    cm->count = components;
-    size = sizeof(ecs_component_pool_t) * components;
-    cm->pools = ECS_MALLOC(size);
-    stack_init(&(cm->available), components);
-    cm->available.top = components;
+static void* pool_read(ecs_component_pool_t* pool, int index) {
+    ecs_chunk_t* chunk = pool->chunks[index >> ECS_CHUNK_SHIFT];
+    char* data = chunk_fetch(pool->pager, chunk);
+    if (!data) return NULL;
+    return data + (pool->size * (index & (ECS_CHUNK_SIZE - 1)));
+}
 
-    for (int i = 0; i < components; i++) {
-        cm->available.data[i] = components - i - 1;
+static char* field_at(ecs_field_layout_t* field, char* data, int index) {
+    return data + field->base + (field->stride * (index & (ECS_CHUNK_SIZE - 1))) + field->inner;
+}
+
+// Returns NULL when the chunk has to be paged in and can't be
+static ecs_chunk_t* pool_unshare(ecs_component_pool_t* pool, int c) {
+    ecs_chunk_t* chunk = pool->chunks[c];
+    if (!chunk) {
+        // Chunks are created on first write, or again after ecs_compact
+        pool->chunks[c] = chunk = chunk_create(pool, c);
+    } else if (chunk->refs > 1) {
+        void* data = chunk_fetch(pool->pager, chunk);
+        if (!data) return NULL;
+        ecs_chunk_t* copy = chunk_create(pool, c);
+        memcpy(copy->data, data, chunk->bytes);
+        chunk_release(chunk);
+        pool->chunks[c] = chunk = copy;
     }
+    if (!chunk_fetch(pool->pager, chunk)) return NULL;
+    chunk->dirty = 1;
+    return chunk;
+}
 
-    // System Manager
-    sm->count = systems;
-    size = sizeof(ecs_system_t) * systems;
-    sm->systems = ECS_MALLOC(size);
-    memset(sm->systems, 0, size);
-    stack_init(&(sm->available), systems);
-    sm->available.top = systems;
+static void* pool_write(ecs_component_pool_t* pool, int index) {
+    ecs_chunk_t* chunk = pool_unshare(pool, index >> ECS_CHUNK_SHIFT);
+    if (!chunk) return NULL;
+    return ((char*)chunk->data) + (pool->size * (index & (ECS_CHUNK_SIZE - 1)));
+}
 
-    for (int i = 0; i < systems; i++) {
-        ecs_system_t* sys = &(sm->systems[i]);
-        sys->enabled = 0;
-        sys->mask = 0;
-        sys->func = NULL;
-        sm->available.data[i] = systems - i - 1;
+static void swap_bytes(char* a, char* b, int size) {
+    for (int i = 0; i < size; i++) {
+        char tmp = a[i];
+        a[i] = b[i];
+        b[i] = tmp;
     }
+}
 
-    world->entity_top = 0;
-    world->system_top = 0;
-
-    // world->filter.entities_count = 0;
-    // world->filter.entities = ECS_MALLOC(sizeof(ecs_entity_t) * entities);
+// The pool helpers below return 0 and leave the pool as it was when a chunk
+// they need can't be paged in
+static int pool_swap(ecs_component_pool_t* pool, int a, int b) {
+    ecs_chunk_t* ca = pool_unshare(pool, a >> ECS_CHUNK_SHIFT);
+    ecs_chunk_t* cb = ca ? pool_unshare(pool, b >> ECS_CHUNK_SHIFT) : NULL;
+    if (!cb) return 0;
+    if (!pool->field_count) {
+        int mask = ECS_CHUNK_SIZE - 1;
+        swap_bytes(((char*)ca->data) + (pool->size * (a & mask)), ((char*)cb->data) + (pool->size * (b & mask)), pool->size);
+        return 1;
+    }
+    for (int i = 0; i < pool->field_count; i++) {
+        ecs_field_layout_t* field = &(pool->fields[i]);
+        swap_bytes(field_at(field, ca->data, a), field_at(field, cb->data, b), field->size);
+    }
+    return 1;
+}
 
-    world->entities = ECS_MALLOC(sizeof(ecs_entity_internal_t) * entities);
-    world->components = ECS_MALLOC(sizeof(ecs_component_pool_t) * components);
-    world->systems = ECS_MALLOC(sizeof(ecs_system_t) * systems);
+static int pool_store(ecs_component_pool_t* pool, int index, void* src) {
+    ecs_chunk_t* chunk = pool_unshare(pool, index >> ECS_CHUNK_SHIFT);
+    if (!chunk) return 0;
+    char* data = chunk->data;
+    if (!src) return 1;
+    if (!pool->field_count) {
+        memcpy(data + (pool->size * (index & (ECS_CHUNK_SIZE - 1))), src, pool->size);
+        return 1;
+    }
+    for (int i = 0; i < pool->field_count; i++) {
+        ecs_field_layout_t* field = &(pool->fields[i]);
+        memcpy(field_at(field, data, index), ((char*)src) + field->offset, field->size);
+    }
+    return 1;
+}
 
-    em->available.top = entities;
-    em->available.size = entities;
-    em->available.data = ECS_MALLOC(sizeof(int) * entities);
+static int pool_copy(ecs_component_pool_t* pool, int dst, int src) {
+    char* sdata = chunk_fetch(pool->pager, pool->chunks[src >> ECS_CHUNK_SHIFT]);
+    ecs_chunk_t* chunk = sdata ? pool_unshare(pool, dst >> ECS_CHUNK_SHIFT) : NULL;
+    if (!chunk) return 0;
+    char* ddata = chunk->data;
+    if (!pool->field_count) {
+        int mask = ECS_CHUNK_SIZE - 1;
+        memcpy(ddata + (pool->size * (dst & mask)), sdata + (pool->size * (src & mask)), pool->size);
+        return 1;
+    }
+    for (int i = 0; i < pool->field_count; i++) {
+        ecs_field_layout_t* field = &(pool->fields[i]);
+        memcpy(field_at(field, ddata, dst), field_at(field, sdata, src), field->size);
+    }
+    return 1;
+}
 
-    for (int i = 0; i < entities; i++) {
-        em->available.data[i] = entities - i;
-        world->entities[i].enabled = 0;
-        world->entities[i].mask = 0;
-        world->entities[i].components = ECS_MALLOC(sizeof(int) * world->max_components);
-        for (int c = 0; c < components; c++) {
-            world->entities[i].components[c] = -1;
-        }
+static int pool_load(ecs_component_pool_t* pool, int index, void* dst) {
+    char* data = chunk_fetch(pool->pager, pool->chunks[index >> ECS_CHUNK_SHIFT]);
+    if (!data) return 0;
+    if (!pool->field_count) {
+        memcpy(dst, data + (pool->size * (index & (ECS_CHUNK_SIZE - 1))), pool->size);
+        return 1;
     }
-    memset(world->components, 0, sizeof(ecs_component_pool_t) * components);
-    memset(world->systems, 0, sizeof(ecs_system_t) * systems);
+    for (int i = 0; i < pool->field_count; i++) {
+        ecs_field_layout_t* field = &(pool->fields[i]);
+        memcpy(((char*)dst) + field->offset, field_at(field, data, index), field->size);
+    }
+    return 1;
+}
 
+static void pool_rebuild_live(ecs_component_pool_t* pool) {
+    memset(pool->live, 0, sizeof(int) * pool->chunk_count);
+    for (int i = 0; i < pool->count; i++) {
+        if (pool->shares[i] > 0) pool->live[i >> ECS_CHUNK_SHIFT]++;
+    }
+}
 
-    return world;
+static void pool_free_push(ecs_component_pool_t* pool, int slot) {
+    meta_touch(&(pool->meta), pool->available.top);
+    pool->free_at[slot] = pool->available.top;
+    stack_push(&(pool->available), slot);
 }
 
-void ecs_destroy(ecs_world_t* w) {
-    if (!w) return;
-    ecs_entity_manager_t* em = &(world->entity_manager);
-    ecs_component_manager_t* cm = &(world->component_manager);
-    ecs_system_manager_t* sm = &(world->system_manager);
+static int pool_free_pop(ecs_component_pool_t* pool) {
+    int slot = stack_pop(&(pool->available));
+    pool->free_at[slot] = -1;
+    return slot;
+}
 
-    for (int i = 0; i < em->count; i++) {
-        ECS_FREE(em->entities.components);
+// Takes a free slot out of the middle of the stack, the top fills its place
+static void pool_free_take(ecs_component_pool_t* pool, int slot) {
+    int at = pool->free_at[slot];
+    int last = stack_pop(&(pool->available));
+    if (last != slot) {
+        meta_touch(&(pool->meta), at);
+        pool->available.data[at] = last;
+        pool->free_at[last] = at;
     }
-    ECS_FREE(em->entities);
-    ECS_FREE(em->available.data);
+    pool->free_at[slot] = -1;
+}
 
-    for (int i = 0; i < cm->count; i++) {
-        ecs_component_pool_t* pool = &(cm->pools[i]);
-        ECS_FREE(pool->available.data);
-        ECS_FREE(pool->data);
+static void pool_index_available(ecs_component_pool_t* pool) {
+    stack_t* stack = &(pool->available);
+    for (int i = 0; i < pool->count; i++) pool->free_at[i] = -1;
+    for (int i = 0; i < stack->top; i++) pool->free_at[stack->data[i]] = i;
+}
+
+static void pool_rebuild_available(ecs_component_pool_t* pool) {
+    // Lowest free slots end up on top, so new components fill from the front
+    stack_t* stack = &(pool->available);
+    stack->top = 0;
+    for (int i = pool->count - 1; i >= 0; i--) {
+        if (!pool->owners[i]) stack_push(stack, i);
     }
-    ECS_FREE(cm->pools);
-    ECS_FREE(cm->available_pools.data);
+    meta_touch_all(&(pool->meta));
+    pool_index_available(pool);
+}
 
-    ECS_FREE(sm->systems);
-    //
-
-    ECS_FREE(w->filter.entities);
-    for (int i = 0; i < w->max_entities; i++) {
-        if (w->entities[i].enabled) ECS_FREE(w->entities[i].components);
-    }
-    ECS_FREE(w->entities);
-    ECS_FREE(w->entitity_manager.
-    for (int i = 0; i < w->max_components; i++) {
-        ecs_component_pool_t* pool = &(w->components[i]);
-        if (pool->size > 0) {
-            ECS_FREE(pool->data);
-            ECS_FREE(pool->available.data);
+static int compare_slots_descending(const void* a, const void* b) {
+    return *(const int*)b - *(const int*)a;
+}
+
+// Same order as a rebuild, but only touches the free slots
+static void pool_sort_available(ecs_component_pool_t* pool) {
+    stack_t* stack = &(pool->available);
+    qsort(stack->data, stack->top, sizeof(int), compare_slots_descending);
+    for (int i = 0; i < stack->top; i += ECS_CHUNK_SIZE) meta_touch(&(pool->meta), i);
+    for (int i = 0; i < stack->top; i++) pool->free_at[stack->data[i]] = i;
+}
+
+static void filter_rebuild(ecs_world_t* w, ecs_filter_t* filter) {
+    ecs_entity_manager_t* em = &(w->entity_manager);
+    filter->entities_count = 0;
+    for (int e = 0; e < em->count; e++) {
+        ecs_entity_internal_t* ent = &(em->entities[e]);
+        if (ent->enabled && !ent->prefab && ((ent->mask & filter->mask) == filter->mask)) {
+            filter->entities[filter->entities_count++] = (e+1);
         }
     }
-    ECS_FREE(w->components);
-    for (int i = 0; i < w->max_systems; i++) {
-        ecs_system_t* sys = &(w->systems[i]);
-        if (sys->enabled) ECS_FREE(sys->filter.entities);
+}
+
+static void update_filters(ecs_world_t* w, int comp) {
+    ecs_system_manager_t* sm = &(w->system_manager);
+    ecs_query_manager_t* qm = &(w->query_manager);
+    for (int i = 0; i < sm->count; i++) {
+        ecs_system_t* sys = &(sm->systems[i]);
+        if (!sys->enabled || !(sys->mask & (1 << comp))) continue;
+        filter_rebuild(w, &(sys->filter));
+    }
+    for (int i = 0; i < qm->count; i++) {
+        ecs_query_t* query = &(qm->queries[i]);
+        if (!query->enabled || !(query->filter.mask & (1 << comp))) continue;
+        filter_rebuild(w, &(query->filter));
     }
-    ECS_FREE(w->systems);
-    ECS_FREE(w);
 }
 
-void ecs_clear_entities(ecs_world_t* w) {
-    if (!w) return;
+static ecs_entity_t find_referrer(ecs_world_t* w, int comp, int slot, ecs_entity_t skip) {
     ecs_entity_manager_t* em = &(w->entity_manager);
-    ecs_component_manager_t* cm = &(w->component_manager);
     for (int i = 0; i < em->count; i++) {
-        em->entities[i].state = 0;
-        em->entities[i].mask = 0;
-        em->available[i] = em->count - i;
+        ecs_entity_internal_t* ee = &(em->entities[i]);
+        if ((ecs_entity_t)(i+1) == skip || !(ee->mask & (1 << comp))) continue;
+        if (ee->components[comp] == slot) return i+1;
+    }
+    return 0;
+}
+
+static void slot_release(ecs_world_t* w, int comp, int slot, ecs_entity_t e) {
+    ecs_component_pool_t* pool = &(w->component_manager.pools[comp]);
+    meta_touch(&(pool->meta), slot);
+    if (--pool->shares[slot] > 0) {
+        // Keep the owner pointing at someone who still uses the slot
+        if (pool->owners[slot] == (int)e) pool->owners[slot] = find_referrer(w, comp, slot, e);
+        return;
     }
+    pool->owners[slot] = 0;
+    pool->live[slot >> ECS_CHUNK_SHIFT]--;
+    pool_free_push(pool, slot);
+}
 
+static void slot_occupy(ecs_component_pool_t* pool, int slot, ecs_entity_t e) {
+    meta_touch(&(pool->meta), slot);
+    pool->owners[slot] = e;
+    pool->shares[slot] = 1;
+    pool->live[slot >> ECS_CHUNK_SHIFT]++;
+}
 
-    for (int i = 0; i < w->entity_top; i++) {
-        ecs_entity_internal_t* ent = &(w->entities[i]);
-        if (ent->enabled) {
-            ent->enabled = 0;
-        }
+// Gives e its own copy of a shared component, returns its slot or -1
+static int slot_unshare(ecs_world_t* w, ecs_entity_t e, int comp) {
+    ecs_entity_internal_t* ee = &(w->entity_manager.entities[e-1]);
+    ecs_component_pool_t* pool = &(w->component_manager.pools[comp]);
+    int slot = ee->components[comp];
+    if (pool->shares[slot] <= 1) return slot;
+    if (pool->available.top <= 0) return -1;
+    int copy = pool_free_pop(pool);
+    if (!pool_copy(pool, copy, slot)) {
+        pool_free_push(pool, copy);
+        return -1;
     }
-    for (int i = 0; i < w->max_components; i++) {
-        ecs_component_pool_t* pool = &(w->components[i]);
-        if (pool->count > 0) {
-            memset(pool->enabled, 0, sizeof(char) * (pool->count / 8));
+    slot_occupy(pool, copy, e);
+    slot_release(w, comp, slot, e);
+    meta_touch(&(w->entity_manager.meta), e-1);
+    ee->components[comp] = copy;
+    return copy;
+}
+
+static void observer_reset(ecs_observer_t* obs) {
+    obs->queue.events_count = 0;
+    obs->removed_size = 0;
+}
+
+static void* observer_store(ecs_observer_t* obs, int size) {
+    if (obs->removed_size + size > obs->removed_capacity) {
+        int capacity = obs->removed_capacity ? obs->removed_capacity : 256;
+        while (capacity < obs->removed_size + size) capacity *= 2;
+        char* removed = ECS_MALLOC(capacity);
+        if (obs->removed_size) memcpy(removed, obs->removed, obs->removed_size);
+        // Queued events point into the old buffer, move them over before
+        // it goes away
+        for (int i = 0; i < obs->queue.events_count; i++) {
+            ecs_event_t* ev = &(obs->queue.events[i]);
+            if (ev->data) ev->data = removed + ((const char*)ev->data - obs->removed);
         }
+        ECS_FREE(obs->removed);
+        obs->removed = removed;
+        obs->removed_capacity = capacity;
     }
-    for (int i = 0; i < w->system_top; i++) {
-        ecs_system_t* sys = &(w->systems[i]);
-        if (sys->enabled) sys->filter.entities_count = 0;
-    }
+    void* data = obs->removed + obs->removed_size;
+    obs->removed_size += size;
+    return data;
 }
 
-void ecs_update(ecs_world_t* w) {
-    if (!w) return;
-    ecs_filter_t* filter = &(w->filter);
-    // for (int i = 0; i < SYSTEM_TYPES; i++) ecs_run_systems(w, i);
-    for (int i = 0; i < w->system_top; i++) {
-        ecs_system_t* sys = &(w->systems[i]);
-        if (sys->enabled) sys->func(&(sys->filter));
+// REMOVE events have to be emitted while e still holds its slot
+static void emit_event(ecs_world_t* w, int type, ecs_entity_t e, int comp, unsigned int mask) {
+    // Prefabs are templates, observers only hear about their instances
+    if (w->entity_manager.entities[e-1].prefab) return;
+    ecs_observer_manager_t* om = &(w->observer_manager);
+    for (int i = 0; i < om->count; i++) {
+        ecs_observer_t* obs = &(om->observers[i]);
+        if (!obs->enabled || !(obs->events & type)) continue;
+        if (!(obs->mask & (1 << comp)) || ((mask & obs->mask) != obs->mask)) continue;
+        ecs_event_queue_t* queue = &(obs->queue);
+        if (queue->events_count >= obs->capacity) {
+            obs->capacity = obs->capacity ? obs->capacity * 2 : 16;
+            queue->events = ECS_REALLOC(queue->events, sizeof(ecs_event_t) * obs->capacity);
+        }
+        ecs_event_t* ev = &(queue->events[queue->events_count++]);
+        ev->type = type;
+        ev->component = comp;
+        ev->entity = e;
+        ev->data = NULL;
+        if (type == ECS_EVENT_REMOVE) {
+            ecs_component_pool_t* pool = &(w->component_manager.pools[comp]);
+            void* data = observer_store(obs, pool->size);
+            if (pool_load(pool, w->entity_manager.entities[e-1].components[comp], data)) ev->data = data;
+        }
     }
 }
 
-void ecs_run_systems(ecs_world_t* w, int type) {
-    if (!w) return;
-    // ecs_filter_t* filter = &(w->filter);
-    // ecs_system_pool_t* pool = &(w->systems[type]);
-    for (int i = 0; i < w->system_top; i++) {
-        // filter->entities_count = 0;
-        ecs_system_t* sys = &(w->systems[i]);
-        // ecs_filter_t* filter = &(sys->filter);
-        // for (int j = 0; j < w->entity_top; j++) {
-        //     if ((w->entities[j].mask & sys->mask) == sys->mask) {
-        //         filter->entities[filter->entities_count++] = j+1;
-        //     }
-        // }
-        if (sys->enabled) sys->func(&(sys->filter));
+static _Atomic unsigned int world_serial;
+// Where the calling thread found its cache last, its address doubles as
+// the thread's owner token
+static _Thread_local unsigned int entity_cache_serial;
+static _Thread_local int entity_cache_slot;
+
+static void free_push(ecs_entity_manager_t* em, int index) {
+    unsigned long long head = atomic_load(&(em->free_head));
+    unsigned long long next;
+    do {
+        atomic_store_explicit(&(em->free_next[index]), (int)(head & 0xffffffff), memory_order_relaxed);
+        next = (((head >> 32) + 1) << 32) | (unsigned int)(index + 1);
+    } while (!atomic_compare_exchange_weak(&(em->free_head), &head, next));
+}
+
+static int free_pop(ecs_entity_manager_t* em) {
+    unsigned long long head = atomic_load(&(em->free_head));
+    unsigned long long next;
+    do {
+        int top = (int)(head & 0xffffffff);
+        if (!top) return -1;
+        int link = atomic_load_explicit(&(em->free_next[top-1]), memory_order_relaxed);
+        // The tag in the high bits keeps a recycled head from passing the CAS
+        next = (((head >> 32) + 1) << 32) | (unsigned int)link;
+    } while (!atomic_compare_exchange_weak(&(em->free_head), &head, next));
+    return (int)(head & 0xffffffff) - 1;
+}
+
+// Caches live in the world, so a thread moving between worlds never loses
+// ids and a destroyed world takes its ids with it
+static ecs_entity_cache_t* entity_cache_for(ecs_world_t* w, int claim) {
+    ecs_entity_manager_t* em = &(w->entity_manager);
+    void* self = &entity_cache_slot;
+    if (entity_cache_serial == w->serial) {
+        ecs_entity_cache_t* cache = &(em->caches[entity_cache_slot]);
+        if (atomic_load_explicit(&(cache->owner), memory_order_relaxed) == self) return cache;
+    }
+    int slot = -1;
+    for (int i = 0; i < ECS_ENTITY_CACHES && slot < 0; i++) {
+        if (atomic_load(&(em->caches[i].owner)) == self) slot = i;
     }
+    for (int i = 0; claim && i < ECS_ENTITY_CACHES && slot < 0; i++) {
+        void* none = NULL;
+        if (atomic_compare_exchange_strong(&(em->caches[i].owner), &none, self)) slot = i;
+    }
+    if (slot < 0) return NULL;
+    entity_cache_serial = w->serial;
+    entity_cache_slot = slot;
+    return &(em->caches[slot]);
 }
 
-ecs_entity_t ecs_create_entity(ecs_world_t* w) {
-    ecs_entity_t e = 0;
-    if (!w) return e;
+static int entity_reserve(ecs_world_t* w) {
     ecs_entity_manager_t* em = &(w->entity_manager);
-    if (em->available.top >= em->available.size) return e;
-    int avail = stack_pop(&(em->available));
-    ecs_entity_internal_t* ee = &(em->entities[avail-1]);
-    ee->enabled = 1;
-    ee->mask = 0;
-    return avail;
-
-    int top = w->entity_top;
-    int i;
-    for (i = 0; i < top; i++) {
-        ecs_entity_internal_t* ent = &(w->entities[i]);
-        if (!ent->enabled) {
-            ent->enabled = 1;
-            ent->mask = 0;
-            break;
+    ecs_entity_cache_t* cache = entity_cache_for(w, 1);
+    if (!cache) {
+        int index = free_pop(em);
+        if (index < 0 && atomic_load(&(em->fresh)) < em->count) {
+            index = atomic_fetch_add(&(em->fresh), 1);
+            if (index >= em->count) index = -1;
         }
+        return index;
     }
-    if (i == top) {
-        ecs_entity_internal_t* ent = &(w->entities[i]);
-        if (!ent->enabled) {
-            ent->enabled = 1;
-            ent->mask = 0;
+    if (!cache->count) {
+        int batch = ECS_ENTITY_CACHE / 2;
+        while (cache->count < batch) {
+            int index = free_pop(em);
+            if (index < 0) break;
+            cache->ids[cache->count++] = index;
+        }
+        if (!cache->count && atomic_load(&(em->fresh)) < em->count) {
+            int first = atomic_fetch_add(&(em->fresh), batch);
+            for (int i = first + batch - 1; i >= first; i--) {
+                if (i < em->count) cache->ids[cache->count++] = i;
+            }
         }
-        w->entity_top++;
     }
-    e = w->entity_top;
-    return e;
+    if (!cache->count) return -1;
+    return cache->ids[--cache->count];
 }
 
-void ecs_destroy_entity(ecs_world_t* w, ecs_entity_t e) {
-    if (!w) return;
-    ecs_entity_manager_t* em = &(w->entity_manager);
-    int index = e - 1;
-    ecs_entity_internal_t* ent = &(em->entities[index]);
-    ent->enabled = 0;
-    ent->mask = 0;
+static void entity_release(ecs_world_t* w, int index) {
+    ecs_entity_cache_t* cache = entity_cache_for(w, 1);
+    if (cache && cache->count < ECS_ENTITY_CACHE) cache->ids[cache->count++] = index;
+    else free_push(&(w->entity_manager), index);
 }
 
-static void enable_component(ecs_world_t* w, int comp, int index, int enable) {
-    ecs_component_pool_t* pool = &(w->components[comp]);
-    int pos = pool->count / 8;
-    int i = index % 8;
-    pool->enabled[pos] &= ~((1 << i) * enable);
+static int entity_alive(ecs_entity_manager_t* em, int index) {
+    return atomic_load(&(em->flags[index])) & ECS_ENTITY_ALIVE;
 }
 
-static int get_free_component(ecs_world_t* w, int comp) {
-    ecs_component_pool_t* pool = &(w->components[comp]);
-    int top = pool->top;
-    int i;
-    for (i = 0; i < pool->count; i++) {
-        int index = pool->count / 8;
-        int ii = i % 8;
-        char enabled = pool->enabled[index];
-        if (!(enabled & (1 << ii))) {
-            pool->enabled[index] |= (1 << ii);
-            break;
-        }
-    }
-    if (i == top) pool->top++;
-
-    return i;
+// Whoever clears the last flag hands the id back
+static void entity_clear_flag(ecs_world_t* w, int index, int flag) {
+    int old = atomic_fetch_and(&(w->entity_manager.flags[index]), ~flag);
+    if (old == flag) entity_release(w, index);
+}
+
+static void entity_free_commands(ecs_command_t* cmd) {
+    while (cmd) {
+        ecs_command_t* next = cmd->next;
+        ECS_FREE(cmd);
+        cmd = next;
+    }
+}
+
+static void entity_rebuild_free_list(ecs_world_t* w) {
+    ecs_entity_manager_t* em = &(w->entity_manager);
+    // Queued ids refer to the entities being replaced
+    atomic_store(&(em->pending_head), 0);
+    atomic_store(&(em->created_head), 0);
+    entity_free_commands(atomic_exchange(&(em->commands), NULL));
+    atomic_store(&(em->free_head), 0);
+    for (int i = 0; i < em->count; i++) {
+        atomic_store(&(em->flags[i]), em->entities[i].enabled ? ECS_ENTITY_ALIVE : 0);
+    }
+    int fresh = atomic_load(&(em->fresh));
+    if (fresh > em->count) fresh = em->count;
+    for (int i = fresh - 1; i >= 0; i--) {
+        if (!em->entities[i].enabled) free_push(em, i);
+    }
+    for (int i = 0; i < ECS_ENTITY_CACHES; i++) em->caches[i].count = 0;
+}
+
+ecs_world_t* ecs_create(int entities, int components, int systems) {
+    ecs_world_t* world = ECS_MALLOC(sizeof(*world));
+    if (!world) return world;
+    memset(world, 0, sizeof(*world));
+    world->serial = atomic_fetch_add(&world_serial, 1) + 1;
+    world->max_entities = entities;
+    world->max_components = components;
+    world->max_systems = systems;
+
+    ecs_entity_manager_t* em = &(world->entity_manager);
+    ecs_component_manager_t* cm = &(world->component_manager);
+    ecs_system_manager_t* sm = &(world->system_manager);
+
+    // Entity Manager
+    em->count = entities;
+    int size = sizeof(ecs_entity_internal_t) * entities; 
+    em->entities = ECS_MALLOC(size);
+    memset(em->entities, 0, size);
+    em->free_next = ECS_MALLOC(sizeof(*(em->free_next)) * entities);
+    em->pending_next = ECS_MALLOC(sizeof(int) * entities);
+    em->created_next = ECS_MALLOC(sizeof(int) * entities);
+    em->flags = ECS_MALLOC(sizeof(*(em->flags)) * entities);
+    em->components = ECS_MALLOC(sizeof(int) * entities * components);
+    atomic_init(&(em->fresh), 0);
+    atomic_init(&(em->free_head), 0);
+    atomic_init(&(em->pending_head), 0);
+    atomic_init(&(em->created_head), 0);
+    atomic_init(&(em->commands), NULL);
+    for (int i = 0; i < ECS_ENTITY_CACHES; i++) atomic_init(&(em->caches[i].owner), NULL);
+
+    for (int i = 0; i < entities; i++) {
+        ecs_entity_internal_t* ee = &(em->entities[i]);
+        ee->enabled = 0;
+        ee->mask = 0;
+        atomic_init(&(em->flags[i]), 0);
+        ee->components = em->components + (i * components);
+        for (int c = 0; c < components; c++) ee->components[c] = -1;
+    }
+    meta_init(&(em->meta), entities, 2, (void*[]){ em->entities, em->components },
+        (int[]){ sizeof(ecs_entity_internal_t), sizeof(int) * components });
+
+    // Component Manager
+    cm->count = components;
+    size = sizeof(ecs_component_pool_t) * components;
+    cm->pools = ECS_MALLOC(size);
+    memset(cm->pools, 0, size);
+    stack_init(&(cm->available), components);
+    cm->available.top = components;
+
+    for (int i = 0; i < components; i++) {
+        cm->available.data[i] = components - i - 1;
+    }
+
+    // System Manager
+    sm->count = systems;
+    size = sizeof(ecs_system_t) * systems;
+    sm->systems = ECS_MALLOC(size);
+    memset(sm->systems, 0, size);
+    stack_init(&(sm->available_systems), systems);
+    sm->available_systems.top = systems;
+
+    for (int i = 0; i < systems; i++) {
+        ecs_system_t* sys = &(sm->systems[i]);
+        sys->enabled = 0;
+        sys->mask = 0;
+        sys->func = NULL;
+        sm->available_systems.data[i] = systems - i - 1;
+    }
+
+    return world;
+}
+
+void ecs_destroy(ecs_world_t* w) {
+    if (!w) return;
+    ecs_entity_manager_t* em = &(w->entity_manager);
+    ecs_component_manager_t* cm = &(w->component_manager);
+    ecs_system_manager_t* sm = &(w->system_manager);
+
+    meta_deinit(&(em->meta));
+    ECS_FREE(em->components);
+    ECS_FREE(em->entities);
+    ECS_FREE((void*)em->free_next);
+    ECS_FREE(em->pending_next);
+    ECS_FREE(em->created_next);
+    ECS_FREE((void*)em->flags);
+    entity_free_commands(atomic_load(&(em->commands)));
+
+    for (int i = 0; i < cm->count; i++) {
+        ecs_component_pool_t* pool = &(cm->pools[i]);
+        stack_deinit(&(pool->available));
+        meta_deinit(&(pool->meta));
+        ECS_FREE(pool->free_at);
+        ECS_FREE(pool->owners);
+        ECS_FREE(pool->shares);
+        ECS_FREE(pool->live);
+        ECS_FREE(pool->fields);
+        pool_release(pool);
+    }
+    ECS_FREE(cm->pools);
+    stack_deinit(&(cm->available));
+
+    for (int i = 0; i < sm->count; i++) {
+        ECS_FREE(sm->systems[i].filter.entities);
+    }
+    ECS_FREE(sm->systems);
+    stack_deinit(&(sm->available_systems));
+
+    for (int i = 0; i < w->observer_manager.count; i++) {
+        ECS_FREE(w->observer_manager.observers[i].queue.events);
+        ECS_FREE(w->observer_manager.observers[i].removed);
+    }
+    ECS_FREE(w->observer_manager.observers);
+    for (int i = 0; i < w->query_manager.count; i++) {
+        ECS_FREE(w->query_manager.queries[i].filter.entities);
+    }
+    ECS_FREE(w->query_manager.queries);
+    ECS_FREE(w->compactor.order);
+    ECS_FREE(w->compactor.next);
+    if (w->pager.file) fclose(w->pager.file);
+    ECS_FREE(w->pager.slots);
+    ECS_FREE(w->pager.pages);
+    ECS_FREE(w->pager.page_chunks);
+    ECS_FREE(w);
+}
+
+void ecs_clear_entities(ecs_world_t* w) {
+    if (!w) return;
+    ecs_entity_manager_t* em = &(w->entity_manager);
+    ecs_component_manager_t* cm = &(w->component_manager);
+    ecs_system_manager_t* sm = &(w->system_manager);
+    // Observers hear about every component going away, the events carry
+    // the data, so they outlive the slots released below
+    for (int i = 0; i < em->count; i++) {
+        ecs_entity_internal_t* ee = &(em->entities[i]);
+        for (int c = 0; c < cm->count; c++) {
+            if (ee->mask & (1 << c)) emit_event(w, ECS_EVENT_REMOVE, i + 1, c, ee->mask);
+        }
+    }
+    for (int i = 0; i < em->count; i++) {
+        ecs_entity_internal_t* ee = &(em->entities[i]);
+        ee->enabled = 0;
+        ee->prefab = 0;
+        ee->mask = 0;
+        for (int c = 0; c < cm->count; c++) ee->components[c] = -1;
+    }
+    meta_touch_all(&(em->meta));
+    // No slot has an owner left, so pools are emptied wholesale, chunks
+    // still held by snapshots are kept alive by their refs
+    for (int i = 0; i < cm->count; i++) {
+        ecs_component_pool_t* pool = &(cm->pools[i]);
+        if (!pool->owners) continue;
+        for (int c = 0; c < pool->chunk_count; c++) {
+            chunk_release(pool->chunks[c]);
+            pool->chunks[c] = NULL;
+        }
+        memset(pool->owners, 0, sizeof(int) * pool->count);
+        memset(pool->shares, 0, sizeof(int) * pool->count);
+        memset(pool->live, 0, sizeof(int) * pool->chunk_count);
+        pool_rebuild_available(pool);
+    }
+    for (int i = 0; i < sm->count; i++) sm->systems[i].filter.entities_count = 0;
+    for (int i = 0; i < w->query_manager.count; i++) {
+        w->query_manager.queries[i].filter.entities_count = 0;
+    }
+    w->compactor.active = 0;
+
+    atomic_store(&(em->fresh), 0);
+    entity_rebuild_free_list(w);
+}
+
+void ecs_update(ecs_world_t* w) {
+    if (!w) return;
+    ecs_sync(w);
+    ecs_evict(w);
+    ecs_flush_observers(w);
+    for (int i = 0; i < ECS_PHASE_COUNT; i++) ecs_run_systems(w, i, w->fixed_step);
+}
+
+void ecs_progress(ecs_world_t* w, float delta) {
+    if (!w) return;
+    ecs_sync(w);
+    ecs_evict(w);
+    ecs_flush_observers(w);
+    ecs_run_systems(w, ECS_PHASE_PRE_UPDATE, delta);
+
+    if (w->fixed_step > 0) {
+        w->accumulator += delta;
+        int steps = 0;
+        while (w->accumulator >= w->fixed_step && steps < ECS_MAX_FIXED_STEPS) {
+            ecs_run_systems(w, ECS_PHASE_FIXED_UPDATE, w->fixed_step);
+            w->accumulator -= w->fixed_step;
+            steps++;
+        }
+        if (steps == ECS_MAX_FIXED_STEPS) w->accumulator = 0;
+    } else {
+        ecs_run_systems(w, ECS_PHASE_FIXED_UPDATE, delta);
+    }
+
+    for (int i = ECS_PHASE_UPDATE; i < ECS_PHASE_COUNT; i++) ecs_run_systems(w, i, delta);
+}
+
+void ecs_run_systems(ecs_world_t* w, int phase, float delta) {
+    if (!w) return;
+    ecs_system_manager_t* sm = &(w->system_manager);
+    for (int i = 0; i < sm->count; i++) {
+        ecs_system_t* sys = &(sm->systems[i]);
+        if (!sys->enabled || sys->phase != phase) continue;
+        // Nothing to iterate, don't pay for the call or bank time for it
+        if (sys->mask && !sys->filter.entities_count) {
+            sys->ticks = 0;
+            sys->elapsed = 0;
+            continue;
+        }
+        sys->elapsed += delta;
+        if (++sys->ticks < sys->interval) continue;
+        sys->filter.delta = sys->elapsed;
+        sys->ticks = 0;
+        sys->elapsed = 0;
+        sys->func(&(sys->filter));
+    }
+}
+
+void ecs_set_fixed_timestep(ecs_world_t* w, float step) {
+    if (!w) return;
+    w->fixed_step = step;
+    w->accumulator = 0;
+}
+
+ecs_entity_t ecs_create_entity(ecs_world_t* w) {
+    ecs_entity_t e = 0;
+    if (!w) return e;
+    ecs_entity_manager_t* em = &(w->entity_manager);
+    int index = entity_reserve(w);
+    if (index < 0) return e;
+    // Free records are already blank, the entity is enabled by ecs_sync so
+    // no other thread writes to it and it can't show up mid frame
+    atomic_fetch_or(&(em->flags[index]), ECS_ENTITY_ALIVE | ECS_ENTITY_CREATED);
+    int head = atomic_load(&(em->created_head));
+    do {
+        em->created_next[index] = head;
+    } while (!atomic_compare_exchange_weak(&(em->created_head), &head, index + 1));
+    return index + 1;
+}
+
+ecs_entity_t ecs_create_prefab(ecs_world_t* w) {
+    ecs_entity_t e = ecs_create_entity(w);
+    if (!e) return e;
+    meta_touch(&(w->entity_manager.meta), e-1);
+    w->entity_manager.entities[e-1].prefab = 1;
+    return e;
+}
+
+int ecs_instantiate(ecs_world_t* w, ecs_entity_t prefab, int count, ecs_entity_t* out) {
+    if (!w || !prefab) return 0;
+    ecs_entity_manager_t* em = &(w->entity_manager);
+    ecs_component_manager_t* cm = &(w->component_manager);
+    ecs_entity_internal_t* pe = &(em->entities[prefab-1]);
+    if (!entity_alive(em, prefab-1)) return 0;
+
+    int created;
+    for (created = 0; created < count; created++) {
+        ecs_entity_t e = ecs_create_entity(w);
+        if (!e) break;
+        ecs_entity_internal_t* ee = &(em->entities[e-1]);
+        meta_touch(&(em->meta), e-1);
+        ee->mask = pe->mask;
+        for (int comp = 0; comp < cm->count; comp++) {
+            if (!(pe->mask & (1 << comp))) continue;
+            ee->components[comp] = pe->components[comp];
+            meta_touch(&(cm->pools[comp].meta), pe->components[comp]);
+            cm->pools[comp].shares[pe->components[comp]]++;
+            emit_event(w, ECS_EVENT_ADD, e, comp, ee->mask);
+        }
+        if (out) out[created] = e;
+    }
+    // Filters pick the whole batch up once it is published by ecs_sync
+    return created;
+}
+
+void ecs_destroy_entity(ecs_world_t* w, ecs_entity_t e) {
+    if (!w) return;
+    ecs_entity_manager_t* em = &(w->entity_manager);
+    ecs_component_manager_t* cm = &(w->component_manager);
+    int index = e - 1;
+    ecs_entity_internal_t* ent = &(em->entities[index]);
+    if (!entity_alive(em, index)) return;
+    unsigned int mask = ent->mask;
+    int visible = ent->enabled;
+    meta_touch(&(em->meta), index);
+    for (int comp = 0; comp < cm->count; comp++) {
+        if (!(mask & (1 << comp))) continue;
+        emit_event(w, ECS_EVENT_REMOVE, e, comp, mask);
+        slot_release(w, comp, ent->components[comp], e);
+        ent->components[comp] = -1;
+    }
+    ent->enabled = 0;
+    ent->prefab = 0;
+    ent->mask = 0;
+    entity_clear_flag(w, index, ECS_ENTITY_ALIVE);
+    for (int comp = 0; comp < cm->count; comp++) {
+        if (visible && (mask & (1 << comp))) update_filters(w, comp);
+    }
+}
+
+void ecs_destroy_entity_deferred(ecs_world_t* w, ecs_entity_t e) {
+    if (!w || !e) return;
+    ecs_entity_manager_t* em = &(w->entity_manager);
+    int index = e - 1;
+    if (index >= em->count) return;
+    // Queueing the same id twice would link the list into a cycle
+    int old = atomic_fetch_or(&(em->flags[index]), ECS_ENTITY_PENDING);
+    if (old & ECS_ENTITY_PENDING) return;
+    if (!(old & ECS_ENTITY_ALIVE)) {
+        atomic_fetch_and(&(em->flags[index]), ~ECS_ENTITY_PENDING);
+        return;
+    }
+    int head = atomic_load(&(em->pending_head));
+    do {
+        em->pending_next[index] = head;
+    } while (!atomic_compare_exchange_weak(&(em->pending_head), &head, index + 1));
+}
+
+void ecs_entity_set_component_deferred(ecs_world_t* w, ecs_entity_t e, int comp, const void* data) {
+    if (!w || !e) return;
+    ecs_entity_manager_t* em = &(w->entity_manager);
+    int index = e - 1;
+    if (index >= em->count) return;
+    int size = data ? w->component_manager.pools[comp].size : 0;
+    ecs_command_t* cmd = ECS_MALLOC(sizeof(ecs_command_t) + size);
+    cmd->entity = e;
+    cmd->component = comp;
+    cmd->size = size;
+    if (size) memcpy(cmd->data, data, size);
+    // The count holds on to the id until the set is applied, so it can't be
+    // recycled and handed to someone else in the meantime
+    int old = atomic_fetch_add(&(em->flags[index]), ECS_ENTITY_SET);
+    if (!(old & ECS_ENTITY_ALIVE)) {
+        atomic_fetch_sub(&(em->flags[index]), ECS_ENTITY_SET);
+        ECS_FREE(cmd);
+        return;
+    }
+    cmd->next = atomic_load(&(em->commands));
+    while (!atomic_compare_exchange_weak(&(em->commands), &(cmd->next), cmd));
+}
+
+static void entity_publish(ecs_world_t* w) {
+    ecs_entity_manager_t* em = &(w->entity_manager);
+    unsigned int mask = 0;
+    int next = atomic_exchange(&(em->created_head), 0);
+    while (next) {
+        int index = next - 1;
+        next = em->created_next[index];
+        // Entities destroyed before they were published are just recycled
+        ecs_entity_internal_t* ee = &(em->entities[index]);
+        if (entity_alive(em, index)) {
+            meta_touch(&(em->meta), index);
+            ee->enabled = 1;
+            mask |= ee->mask;
+        }
+        entity_clear_flag(w, index, ECS_ENTITY_CREATED);
+    }
+    for (int comp = 0; comp < w->component_manager.count; comp++) {
+        if (mask & (1 << comp)) update_filters(w, comp);
+    }
+}
+
+static int get_free_component(ecs_world_t* w, int comp) {
+    ecs_component_pool_t* pool = &(w->component_manager.pools[comp]);
+    if (pool->available.top <= 0) return -1;
+    return pool_free_pop(pool);
+}
+
+// Components e didn't have before are added to *added when it's given,
+// for the caller to refresh filters once for a whole batch
+static int entity_set_component(ecs_world_t* w, ecs_entity_t e, int comp, void* data, unsigned int* added) {
+    ecs_entity_internal_t* ent = &(w->entity_manager.entities[e-1]);
+    ecs_component_pool_t* pool = &(w->component_manager.pools[comp]);
+    int i = 0;
+    if (ent->mask & (1 << comp)) {
+        i = slot_unshare(w, e, comp);
+        if (i < 0 || !pool_store(pool, i, data)) return 0;
+    } else {
+        i = get_free_component(w, comp);
+        if (i < 0) return 0;
+        if (!pool_store(pool, i, data)) {
+            pool_free_push(pool, i);
+            return 0;
+        }
+        meta_touch(&(w->entity_manager.meta), e-1);
+        ent->components[comp] = i;
+        slot_occupy(pool, i, e);
+    }
+    int fresh = !(ent->mask & (1 << comp));
+    ent->mask |= (1 << comp);
+    if (fresh) emit_event(w, ECS_EVENT_ADD, e, comp, ent->mask);
+    if (data) emit_event(w, ECS_EVENT_SET, e, comp, ent->mask);
+    if (fresh && ent->enabled) {
+        if (added) *added |= (1 << comp);
+        else update_filters(w, comp);
+    }
+    return 1;
+}
+
+static void entity_apply_commands(ecs_world_t* w) {
+    ecs_entity_manager_t* em = &(w->entity_manager);
+    // Queued newest first, reversed so the last set of a component wins
+    ecs_command_t* cmd = atomic_exchange(&(em->commands), NULL);
+    ecs_command_t* ordered = NULL;
+    while (cmd) {
+        ecs_command_t* next = cmd->next;
+        cmd->next = ordered;
+        ordered = cmd;
+        cmd = next;
+    }
+    unsigned int added = 0;
+    for (cmd = ordered; cmd; cmd = cmd->next) {
+        if (!entity_alive(em, cmd->entity - 1)) continue;
+        entity_set_component(w, cmd->entity, cmd->component, cmd->size ? cmd->data : NULL, &added);
+    }
+    // Ids are let go only once nothing queued refers to them
+    for (cmd = ordered; cmd; cmd = cmd->next) {
+        int old = atomic_fetch_sub(&(em->flags[cmd->entity - 1]), ECS_ENTITY_SET);
+        if (old == ECS_ENTITY_SET) entity_release(w, cmd->entity - 1);
+    }
+    entity_free_commands(ordered);
+    for (int comp = 0; comp < w->component_manager.count; comp++) {
+        if (added & (1 << comp)) update_filters(w, comp);
+    }
+}
+
+void ecs_sync(ecs_world_t* w) {
+    if (!w) return;
+    ecs_entity_manager_t* em = &(w->entity_manager);
+    entity_publish(w);
+    entity_apply_commands(w);
+    int next = atomic_exchange(&(em->pending_head), 0);
+    while (next) {
+        int index = next - 1;
+        next = em->pending_next[index];
+        ecs_destroy_entity(w, index + 1);
+        entity_clear_flag(w, index, ECS_ENTITY_PENDING);
+    }
+}
+
+void ecs_flush_entity_cache(ecs_world_t* w) {
+    if (!w) return;
+    ecs_entity_cache_t* cache = entity_cache_for(w, 0);
+    if (!cache) return;
+    while (cache->count > 0) free_push(&(w->entity_manager), cache->ids[--cache->count]);
+    atomic_store(&(cache->owner), NULL);
 }
 
 void ecs_register_component(ecs_world_t* w, int index, unsigned int size, unsigned int count) {
     if (!w) return;
-    ecs_component_pool_t* comp = &(w->components[index]);
-    comp->state = ECS_COMPONENT_ENABLED & ECS_COMPONENT_LOADED;
+    ecs_component_pool_t* comp = &(w->component_manager.pools[index]);
+    comp->state = ECS_STATE_ENABLED | ECS_STATE_LOADED;
     comp->count = count;
     comp->size = size;
-    if (comp->data)
-        comp->data = ECS_REALLOC(size * count);
-    else 
-        comp->data = ECS_MALLOC(size * count);
+
+    pool_release(comp);
+    comp->index = index;
+    comp->pager = &(w->pager);
+    comp->chunk_bytes = size * ECS_CHUNK_SIZE;
+    comp->field_count = 0;
+    ECS_FREE(comp->fields);
+    comp->fields = NULL;
+    comp->chunk_count = (count + ECS_CHUNK_SIZE - 1) >> ECS_CHUNK_SHIFT;
+    comp->chunks = ECS_MALLOC(sizeof(ecs_chunk_t*) * comp->chunk_count);
+    memset(comp->chunks, 0, sizeof(ecs_chunk_t*) * comp->chunk_count);
 
     stack_t* stack = &(comp->available);
     stack->top = count;
     stack->size = count;
     if (stack->data)
-        stack->data = (int*)ECS_REALLOC(sizeof(int) * count);
+        stack->data = (int*)ECS_REALLOC(stack->data, sizeof(int) * count);
     else
         stack->data = (int*)ECS_MALLOC(sizeof(int) * count);
 
-    for (int i = (count-1); i >= 0; i--) stack->data[i] = i;
+    for (unsigned int i = 0; i < count; i++) stack->data[i] = count - i - 1;
+    ECS_FREE(comp->free_at);
+    comp->free_at = ECS_MALLOC(sizeof(int) * count);
+    for (unsigned int i = 0; i < count; i++) comp->free_at[i] = count - i - 1;
+
+    ECS_FREE(comp->owners);
+    comp->owners = ECS_MALLOC(sizeof(int) * count);
+    memset(comp->owners, 0, sizeof(int) * count);
+    ECS_FREE(comp->shares);
+    comp->shares = ECS_MALLOC(sizeof(int) * count);
+    memset(comp->shares, 0, sizeof(int) * count);
+    ECS_FREE(comp->live);
+    comp->live = ECS_MALLOC(sizeof(int) * comp->chunk_count);
+    memset(comp->live, 0, sizeof(int) * comp->chunk_count);
+    meta_init(&(comp->meta), count, 3, (void*[]){ comp->owners, comp->shares, stack->data },
+        (int[]){ sizeof(int), sizeof(int), sizeof(int) });
+}
+
+static int field_align(int size) {
+    int align = 1;
+    while (align < 16 && !(size & align)) align <<= 1;
+    return align;
+}
+
+void ecs_register_component_fields(ecs_world_t* w, int index, unsigned int count, int field_count, ecs_field_t* fields) {
+    if (!w) return;
+    int size = 0;
+    for (int i = 0; i < field_count; i++) {
+        if (fields[i].offset + fields[i].size > size) size = fields[i].offset + fields[i].size;
+    }
+    ecs_register_component(w, index, size, count);
+
+    ecs_component_pool_t* comp = &(w->component_manager.pools[index]);
+    comp->field_count = field_count;
+    comp->fields = ECS_MALLOC(sizeof(ecs_field_layout_t) * field_count);
+    for (int i = 0; i < field_count; i++) comp->fields[i].stride = -1;
+
+    // Lay groups out one after the other, in order of first appearance, each
+    // starting on a 16 byte boundary inside the chunk
+    int base = 0;
+    for (int i = 0; i < field_count; i++) {
+        if (comp->fields[i].stride >= 0) continue;
+        int group = fields[i].group;
+        int stride = 0;
+        int align = 1;
+        for (int j = i; j < field_count; j++) {
+            if (fields[j].group != group) continue;
+            int a = field_align(fields[j].size);
+            stride = (stride + a - 1) & ~(a - 1);
+            comp->fields[j].offset = fields[j].offset;
+            comp->fields[j].size = fields[j].size;
+            comp->fields[j].inner = stride;
+            comp->fields[j].base = base;
+            stride += fields[j].size;
+            if (a > align) align = a;
+        }
+        stride = (stride + align - 1) & ~(align - 1);
+        for (int j = i; j < field_count; j++) {
+            if (fields[j].group == group) comp->fields[j].stride = stride;
+        }
+        base += ((stride * ECS_CHUNK_SIZE) + 15) & ~15;
+    }
+    comp->chunk_bytes = base;
 }
 
 void ecs_unregister_component(ecs_world_t* w, int index) {
     if (!w) return;
-    ecs_component_pool_t* comp = &(w->components[index]);
+    ecs_component_pool_t* comp = &(w->component_manager.pools[index]);
     comp->state = 0;
 }
 
+static ecs_system_t* find_system(ecs_world_t* w, ecs_system_func_t fn) {
+    ecs_system_manager_t* sm = &(w->system_manager);
+    for (int i = 0; i < sm->count; i++) {
+        ecs_system_t* sys = &(sm->systems[i]);
+        if (sys->enabled && sys->func == fn) return sys;
+    }
+    return NULL;
+}
+
 void ecs_register_system(ecs_world_t* w, ecs_system_func_t fn, int filter_count, int* filters) {
     if (!w) return;
     ecs_entity_manager_t* em = &(w->entity_manager);
-    ecs_component_manager_t* cm = &(w->component_manager);
     ecs_system_manager_t* sm = &(w->system_manager);
     stack_t* stack = &(sm->available_systems);
-    if (stack->top >= stack->size) return;
+    if (stack->top <= 0) return;
 
     int index = stack_pop(stack);
 
@@ -477,89 +1692,620 @@ void ecs_register_system(ecs_world_t* w, ecs_system_func_t fn, int filter_count,
     sys->enabled = 1;
     sys->func = fn;
     sys->mask = 0;
-    int max_count = 0;
-
-    for (int i = 0; i < filter_count; i++) {
-        sys->mask |= (1 << filters[i]);
-        ecs_component_pool_t* comp = &(em->pools);
-        if (comp->count > max_count) max_count = comp->count;
-    }
-    sys->filter.entities_count = 0;
-    sys->filter.entities = ECS_MALLOC(sizeof(ecs_entity_t) * max_count);
-
-    for (int i = 0; i < em->count; i++) {
-        ecs_entity_internal_t* ee = em->entities + i;
-        if (ee->mask == sys->mask)
-    }
-
-    // ecs_system_pool_t* pool = &(w->systems[type]);
-    ecs_system_t* sys = &(w->systems[w->system_top++]);
-    sys->enabled = 1;
-    sys->func = fn;
-    sys->mask = 0;
-    int max_count = 0;
-    for (int i = 0; i < filter_count; i++) {
-        sys->mask |= (1 << filters[i]);
-        ecs_component_pool_t* comp = &(w->components[filters[i]]);
-        if (comp->count > max_count) max_count = comp->count;
-        // if (comp->)
-    }
+    sys->phase = ECS_PHASE_UPDATE;
+    sys->interval = 1;
+    sys->ticks = 0;
+    sys->elapsed = 0;
+    for (int i = 0; i < filter_count; i++) sys->mask |= (1 << filters[i]);
+
+    sys->filter.world = w;
+    sys->filter.mask = sys->mask;
+    sys->filter.delta = 0;
     sys->filter.entities_count = 0;
-    sys->filter.entities = ECS_MALLOC(sizeof(ecs_entity_t) * max_count);
-    memset(sys->filter.entities, 0, sizeof(ecs_entity_t) * max_count);
+    sys->filter.entities = ECS_MALLOC(sizeof(ecs_entity_t) * em->count);
+    filter_rebuild(w, &(sys->filter));
 }
 
 void ecs_unregister_system(ecs_world_t* w, ecs_system_func_t fn) {
     if (!w) return;
-    // ecs_system_pool_t* pool = &(w->systems[type]);
-    ecs_system_t* sys = NULL;
-    for (int i = 0; i < w->system_top; i++) {
-        ecs_system_t* s = &(w->systems[i]);
-        if (s->enabled && s->func == fn) sys = s;
-    }
+    ecs_system_t* sys = find_system(w, fn);
     if (!sys) return;
-    // ecs_system_t* sys = &(pool->systems[pool->top++]);
     sys->enabled = 0;
     sys->func = NULL;
     ECS_FREE(sys->filter.entities);
+    sys->filter.entities = NULL;
+    stack_push(&(w->system_manager.available_systems), sys - w->system_manager.systems);
+}
+
+void ecs_system_set_phase(ecs_world_t* w, ecs_system_func_t fn, int phase) {
+    if (!w || phase < 0 || phase >= ECS_PHASE_COUNT) return;
+    ecs_system_t* sys = find_system(w, fn);
+    if (sys) sys->phase = phase;
 }
 
-void ecs_entity_set_component(ecs_world_t* w, ecs_entity_t e, int comp, void* data) {
+void ecs_system_set_interval(ecs_world_t* w, ecs_system_func_t fn, int ticks) {
     if (!w) return;
-    ecs_entity_internal_t* ent = &(w->entities[e-1]);
-    int i = 0;
-    if (ent->mask & (1 << comp)) {
-        i = ent->components[comp];
-    } else {
-        i = get_free_component(w, comp);
-        ent->components[comp] = i;
-    }
-    ecs_component_pool_t* pool = &(w->components[comp]);
-    char* comp_data = ((char*)pool->data) + (pool->size * i);
-    if (data) memcpy(comp_data, data, pool->size);
-    ent->mask |= (1 << comp);
-    update_filters(w, comp);
+    ecs_system_t* sys = find_system(w, fn);
+    if (!sys) return;
+    sys->interval = ticks > 0 ? ticks : 1;
+    sys->ticks = 0;
+}
+
+int ecs_entity_set_component(ecs_world_t* w, ecs_entity_t e, int comp, void* data) {
+    if (!w) return 0;
+    return entity_set_component(w, e, comp, data, NULL);
 }
 
 void* ecs_entity_get_component(ecs_world_t* w, ecs_entity_t e, int comp) {
     if (!w) return NULL;
-    ecs_entity_internal_t* ee = &(w->entities[e-1]);
+    ecs_entity_internal_t* ee = &(w->entity_manager.entities[e-1]);
     if (!(ee->mask & (1 << comp))) return NULL;
-    int index = ee->components[comp];
+    ecs_component_pool_t* pool = &(w->component_manager.pools[comp]);
+    if (pool->field_count) return NULL;
+    // The caller may write through the pointer, so neither the component nor
+    // its chunk can stay shared
+    int index = slot_unshare(w, e, comp);
     if (index < 0) return NULL;
-    ecs_component_pool_t* pool = &(w->components[comp]);
-    void* data = ((char*)pool->data) + (index * pool->size);
-    return data;
+    return pool_write(pool, index);
+}
+
+const void* ecs_entity_read_component(ecs_world_t* w, ecs_entity_t e, int comp) {
+    if (!w) return NULL;
+    ecs_entity_internal_t* ee = &(w->entity_manager.entities[e-1]);
+    if (!(ee->mask & (1 << comp))) return NULL;
+    ecs_component_pool_t* pool = &(w->component_manager.pools[comp]);
+    if (pool->field_count) return NULL;
+    return pool_read(pool, ee->components[comp]);
+}
+
+void* ecs_entity_get_field(ecs_world_t* w, ecs_entity_t e, int comp, int field) {
+    if (!w) return NULL;
+    ecs_entity_internal_t* ee = &(w->entity_manager.entities[e-1]);
+    if (!(ee->mask & (1 << comp))) return NULL;
+    int index = slot_unshare(w, e, comp);
+    if (index < 0) return NULL;
+    ecs_component_pool_t* pool = &(w->component_manager.pools[comp]);
+    if (!pool->field_count) return field ? NULL : pool_write(pool, index);
+    if (field < 0 || field >= pool->field_count) return NULL;
+    ecs_chunk_t* chunk = pool_unshare(pool, index >> ECS_CHUNK_SHIFT);
+    if (!chunk) return NULL;
+    return field_at(&(pool->fields[field]), chunk->data, index);
+}
+
+int ecs_entity_copy_component(ecs_world_t* w, ecs_entity_t e, int comp, void* out) {
+    if (!w || !out) return 0;
+    ecs_entity_internal_t* ee = &(w->entity_manager.entities[e-1]);
+    if (!(ee->mask & (1 << comp))) return 0;
+    return pool_load(&(w->component_manager.pools[comp]), ee->components[comp], out);
 }
 
 void ecs_entity_remove_component(ecs_world_t* w, ecs_entity_t e, int comp) {
     if (!w) return;
-    ecs_entity_internal_t* ee = &(w->entities[e-1]);
+    ecs_entity_internal_t* ee = &(w->entity_manager.entities[e-1]);
     if (!(ee->mask & (1 << comp))) return;
+    emit_event(w, ECS_EVENT_REMOVE, e, comp, ee->mask);
+    meta_touch(&(w->entity_manager.meta), e-1);
     ee->mask &= ~(1 << comp);
-    enable_component(w, comp, ee->components[comp], 0);
+    slot_release(w, comp, ee->components[comp], e);
     ee->components[comp] = -1;
-    update_filters(w, comp);
+    if (ee->enabled) update_filters(w, comp);
+}
+
+ecs_entity_internal_t* ecs_entities(ecs_world_t* w, int* count) {
+    if (!w) return NULL;
+    ecs_entity_manager_t* em = &(w->entity_manager);
+    if (count) *count = em->count;
+    return em->entities;
+}
+
+const int* ecs_component_shares(ecs_world_t* w, int comp) {
+    if (!w) return NULL;
+    return w->component_manager.pools[comp].shares;
+}
+
+int ecs_component_chunk_count(ecs_world_t* w, int comp) {
+    if (!w) return 0;
+    return w->component_manager.pools[comp].chunk_count;
+}
+
+int ecs_component_field_count(ecs_world_t* w, int comp) {
+    if (!w) return 0;
+    return w->component_manager.pools[comp].field_count;
+}
+
+int ecs_component_chunk_live(ecs_world_t* w, int comp, int chunk) {
+    if (!w) return 0;
+    ecs_component_pool_t* pool = &(w->component_manager.pools[comp]);
+    if (chunk < 0 || chunk >= pool->chunk_count) return 0;
+    return pool->live[chunk];
+}
+
+void* ecs_component_chunk(ecs_world_t* w, int comp, int chunk, int write) {
+    if (!w) return NULL;
+    ecs_component_pool_t* pool = &(w->component_manager.pools[comp]);
+    if (chunk < 0 || chunk >= pool->chunk_count) return NULL;
+    if (write) {
+        ecs_chunk_t* unshared = pool_unshare(pool, chunk);
+        return unshared ? unshared->data : NULL;
+    }
+    if (!pool->chunks[chunk]) return NULL;
+    return chunk_fetch(pool->pager, pool->chunks[chunk]);
+}
+
+void* ecs_component_field(ecs_world_t* w, int comp, int chunk, int field, int* stride, int write) {
+    char* data = ecs_component_chunk(w, comp, chunk, write);
+    if (!data) return NULL;
+    ecs_component_pool_t* pool = &(w->component_manager.pools[comp]);
+    if (!pool->field_count) {
+        if (field) return NULL;
+        if (stride) *stride = pool->size;
+        return data;
+    }
+    if (field < 0 || field >= pool->field_count) return NULL;
+    ecs_field_layout_t* layout = &(pool->fields[field]);
+    if (stride) *stride = layout->stride;
+    return data + layout->base + layout->inner;
+}
+
+/*=================================*
+ *             Paging              *
+ *=================================*/
+
+int ecs_paging_error(ecs_world_t* w) {
+    if (!w) return 0;
+    int error = w->pager.error;
+    w->pager.error = 0;
+    return error;
+}
+
+int ecs_set_paging(ecs_world_t* w, const char* path, int max_resident, ecs_evict_func_t policy) {
+    if (!w) return 0;
+    ecs_pager_t* pager = &(w->pager);
+    if (pager->file) return 0;
+    pager->file = fopen(path, "w+b");
+    if (!pager->file) return 0;
+    pager->end = 0;
+    pager->max_resident = max_resident;
+    pager->policy = policy;
+
+    // Chunks made before paging was turned on join the list as they are
+    ecs_component_manager_t* cm = &(w->component_manager);
+    for (int i = 0; i < cm->count; i++) {
+        ecs_component_pool_t* pool = &(cm->pools[i]);
+        for (int c = 0; c < pool->chunk_count; c++) {
+            ecs_chunk_t* chunk = pool->chunks[c];
+            if (chunk && chunk->data && !chunk->listed) chunk_link(pager, chunk);
+        }
+    }
+    return 1;
+}
+
+void ecs_evict(ecs_world_t* w) {
+    if (!w) return;
+    ecs_pager_t* pager = &(w->pager);
+    pager->clock++;
+    if (!pager->file || pager->resident <= pager->max_resident) return;
+
+    if (!pager->policy) {
+        while (pager->resident > pager->max_resident) {
+            ecs_chunk_t* chunk = pager->tail;
+            chunk_evict(pager, chunk);
+            // A failed write leaves the chunk resident, try again next update
+            if (chunk->data) break;
+        }
+        return;
+    }
+
+    // Policies pick from every resident chunk, least recently used first
+    int count = pager->resident;
+    if (count > pager->page_capacity) {
+        pager->page_capacity = count;
+        pager->pages = ECS_REALLOC(pager->pages, sizeof(ecs_page_t) * count);
+        pager->page_chunks = ECS_REALLOC(pager->page_chunks, sizeof(ecs_chunk_t*) * count);
+    }
+    int n = 0;
+    for (ecs_chunk_t* chunk = pager->tail; chunk; chunk = chunk->prev) {
+        pager->pages[n].component = chunk->component;
+        pager->pages[n].chunk = chunk->index;
+        pager->pages[n].last_use = chunk->stamp;
+        pager->page_chunks[n] = chunk;
+        n++;
+    }
+    int excess = count - pager->max_resident;
+    for (int i = 0; i < excess; i++) {
+        int pick = pager->policy(w, pager->pages, n);
+        if (pick < 0 || pick >= n) break;
+        chunk_evict(pager, pager->page_chunks[pick]);
+        n--;
+        pager->pages[pick] = pager->pages[n];
+        pager->page_chunks[pick] = pager->page_chunks[n];
+    }
+}
+
+void ecs_evict_chunk(ecs_world_t* w, int comp, int chunk) {
+    if (!w) return;
+    ecs_component_pool_t* pool = &(w->component_manager.pools[comp]);
+    if (chunk < 0 || chunk >= pool->chunk_count) return;
+    chunk_evict(&(w->pager), pool->chunks[chunk]);
+}
+
+void ecs_prefetch(ecs_world_t* w, ecs_entity_t e) {
+    if (!w) return;
+    ecs_component_manager_t* cm = &(w->component_manager);
+    ecs_entity_internal_t* ee = &(w->entity_manager.entities[e-1]);
+    for (int comp = 0; comp < cm->count; comp++) {
+        if (!(ee->mask & (1 << comp))) continue;
+        ecs_prefetch_chunk(w, comp, ee->components[comp] >> ECS_CHUNK_SHIFT);
+    }
+}
+
+void ecs_prefetch_chunk(ecs_world_t* w, int comp, int chunk) {
+    ecs_component_chunk(w, comp, chunk, 0);
+}
+
+/*=================================*
+ *             Queries             *
+ *=================================*/
+
+int ecs_register_query(ecs_world_t* w, int filter_count, int* filters) {
+    if (!w) return -1;
+    ecs_query_manager_t* qm = &(w->query_manager);
+    int index;
+    for (index = 0; index < qm->count; index++) {
+        if (!qm->queries[index].enabled) break;
+    }
+    if (index == qm->count) {
+        qm->count++;
+        qm->queries = ECS_REALLOC(qm->queries, sizeof(ecs_query_t) * qm->count);
+        memset(&(qm->queries[index]), 0, sizeof(ecs_query_t));
+    }
+
+    ecs_query_t* query = &(qm->queries[index]);
+    query->enabled = 1;
+    query->filter.world = w;
+    query->filter.mask = 0;
+    query->filter.delta = 0;
+    for (int i = 0; i < filter_count; i++) query->filter.mask |= (1 << filters[i]);
+    if (!query->filter.entities) {
+        query->filter.entities = ECS_MALLOC(sizeof(ecs_entity_t) * w->entity_manager.count);
+    }
+    filter_rebuild(w, &(query->filter));
+    return index;
+}
+
+void ecs_unregister_query(ecs_world_t* w, int query) {
+    if (!w || query < 0 || query >= w->query_manager.count) return;
+    w->query_manager.queries[query].enabled = 0;
+    w->query_manager.queries[query].filter.entities_count = 0;
+}
+
+ecs_filter_t* ecs_query_filter(ecs_world_t* w, int query) {
+    if (!w || query < 0 || query >= w->query_manager.count) return NULL;
+    if (!w->query_manager.queries[query].enabled) return NULL;
+    return &(w->query_manager.queries[query].filter);
+}
+
+/*=================================*
+ *            Observers            *
+ *=================================*/
+
+int ecs_register_observer(ecs_world_t* w, int events, ecs_observer_func_t fn, int filter_count, int* filters) {
+    if (!w) return -1;
+    ecs_observer_manager_t* om = &(w->observer_manager);
+    int index;
+    for (index = 0; index < om->count; index++) {
+        if (!om->observers[index].enabled) break;
+    }
+    if (index == om->count) {
+        om->count++;
+        om->observers = ECS_REALLOC(om->observers, sizeof(ecs_observer_t) * om->count);
+        memset(&(om->observers[index]), 0, sizeof(ecs_observer_t));
+    }
+
+    ecs_observer_t* obs = &(om->observers[index]);
+    obs->enabled = 1;
+    obs->events = events;
+    obs->func = fn;
+    obs->mask = 0;
+    for (int i = 0; i < filter_count; i++) obs->mask |= (1 << filters[i]);
+    obs->queue.world = w;
+    obs->queue.observer = index;
+    observer_reset(obs);
+    return index;
+}
+
+void ecs_unregister_observer(ecs_world_t* w, int observer) {
+    if (!w || observer < 0 || observer >= w->observer_manager.count) return;
+    ecs_observer_t* obs = &(w->observer_manager.observers[observer]);
+    obs->enabled = 0;
+    obs->func = NULL;
+    observer_reset(obs);
+}
+
+ecs_event_queue_t* ecs_observer_queue(ecs_world_t* w, int observer) {
+    if (!w || observer < 0 || observer >= w->observer_manager.count) return NULL;
+    return &(w->observer_manager.observers[observer].queue);
+}
+
+void ecs_observer_clear(ecs_world_t* w, int observer) {
+    if (!w || observer < 0 || observer >= w->observer_manager.count) return;
+    observer_reset(&(w->observer_manager.observers[observer]));
+}
+
+void ecs_flush_observers(ecs_world_t* w) {
+    if (!w) return;
+    ecs_observer_manager_t* om = &(w->observer_manager);
+    for (int i = 0; i < om->count; i++) {
+        ecs_observer_t* obs = &(om->observers[i]);
+        if (!obs->enabled || !obs->func || !obs->queue.events_count) continue;
+        // The queue is swapped out before delivery, events the callback
+        // causes are queued again and wait for the next flush
+        ecs_event_queue_t queue = obs->queue;
+        int capacity = obs->capacity;
+        char* removed = obs->removed;
+        int removed_capacity = obs->removed_capacity;
+        obs->queue.events_count = 0;
+        obs->queue.events = NULL;
+        obs->capacity = 0;
+        obs->removed = NULL;
+        obs->removed_size = 0;
+        obs->removed_capacity = 0;
+        obs->func(&queue);
+
+        // The callback may have registered observers and moved the array
+        obs = &(om->observers[i]);
+        if (!obs->queue.events) {
+            obs->queue.events = queue.events;
+            obs->capacity = capacity;
+        } else {
+            ECS_FREE(queue.events);
+        }
+        if (!obs->removed) {
+            obs->removed = removed;
+            obs->removed_capacity = removed_capacity;
+        } else {
+            ECS_FREE(removed);
+        }
+    }
+}
+
+/*=================================*
+ *           Compaction            *
+ *=================================*/
+
+typedef struct {
+    unsigned int mask;
+    int index;
+} ecs_compact_key_t;
+
+static int compare_compact_keys(const void* a, const void* b) {
+    const ecs_compact_key_t* ka = a;
+    const ecs_compact_key_t* kb = b;
+    if (ka->mask != kb->mask) return ka->mask < kb->mask ? -1 : 1;
+    return ka->index - kb->index;
+}
+
+static void compact_begin(ecs_world_t* w, int flags) {
+    ecs_entity_manager_t* em = &(w->entity_manager);
+    ecs_component_manager_t* cm = &(w->component_manager);
+    ecs_compactor_t* c = &(w->compactor);
+    if (!c->order) {
+        c->order = ECS_MALLOC(sizeof(int) * em->count);
+        c->next = ECS_MALLOC(sizeof(int) * cm->count);
+    }
+    memset(c->next, 0, sizeof(int) * cm->count);
+
+    ecs_compact_key_t* keys = ECS_MALLOC(sizeof(ecs_compact_key_t) * em->count);
+    int count = 0;
+    for (int i = 0; i < em->count; i++) {
+        ecs_entity_internal_t* ee = &(em->entities[i]);
+        if (!ee->enabled || !ee->mask) continue;
+        keys[count].mask = (flags & ECS_COMPACT_ARCHETYPE) ? ee->mask : 0;
+        keys[count].index = i;
+        count++;
+    }
+    if (flags & ECS_COMPACT_ARCHETYPE) qsort(keys, count, sizeof(*keys), compare_compact_keys);
+    for (int i = 0; i < count; i++) c->order[i] = keys[i].index;
+    ECS_FREE(keys);
+
+    c->active = 1;
+    c->flags = flags;
+    c->cursor = 0;
+    c->order_count = count;
+}
+
+static void compact_entity(ecs_world_t* w, int index) {
+    ecs_entity_manager_t* em = &(w->entity_manager);
+    ecs_component_manager_t* cm = &(w->component_manager);
+    ecs_compactor_t* c = &(w->compactor);
+    ecs_entity_internal_t* ee = &(em->entities[index]);
+    if (!ee->enabled) return;
+
+    for (int comp = 0; comp < cm->count; comp++) {
+        if (!(ee->mask & (1 << comp))) continue;
+        ecs_component_pool_t* pool = &(cm->pools[comp]);
+        int slot = ee->components[comp];
+        // Shared slots would need every referrer re-pointed, the dense run
+        // flows around them instead
+        if (pool->shares[slot] > 1) continue;
+        while (c->next[comp] < pool->count && pool->shares[c->next[comp]] > 1) c->next[comp]++;
+        int target = c->next[comp];
+        // Slots below the cursor are already dense, leave them alone
+        if (slot < target) continue;
+        if (slot == target) {
+            c->next[comp]++;
+            continue;
+        }
+        // A chunk that can't be paged in keeps its slots where they are
+        if (!pool_swap(pool, slot, target)) continue;
+        c->next[comp]++;
+
+        int other = pool->owners[target];
+        if (other) {
+            meta_touch(&(em->meta), other-1);
+            em->entities[other-1].components[comp] = slot;
+        }
+        meta_touch(&(em->meta), index);
+        meta_touch(&(pool->meta), slot);
+        meta_touch(&(pool->meta), target);
+        ee->components[comp] = target;
+        pool->owners[target] = pool->owners[slot];
+        pool->owners[slot] = other;
+        int shares = pool->shares[target];
+        pool->shares[target] = pool->shares[slot];
+        pool->shares[slot] = shares;
+        if (!shares) {
+            // Moved into a free slot, possibly in another chunk
+            pool->live[target >> ECS_CHUNK_SHIFT]++;
+            pool->live[slot >> ECS_CHUNK_SHIFT]--;
+            pool_free_take(pool, target);
+            pool_free_push(pool, slot);
+        }
+    }
+}
+
+static void compact_shrink(ecs_component_pool_t* pool) {
+    int last = pool->count - 1;
+    while (last >= 0 && !pool->owners[last]) last--;
+    int first_free = (last + ECS_CHUNK_SIZE) >> ECS_CHUNK_SHIFT;
+    for (int i = first_free; i < pool->chunk_count; i++) {
+        chunk_release(pool->chunks[i]);
+        pool->chunks[i] = NULL;
+    }
+}
+
+int ecs_compact(ecs_world_t* w, int budget, int flags) {
+    if (!w) return 1;
+    ecs_component_manager_t* cm = &(w->component_manager);
+    ecs_compactor_t* c = &(w->compactor);
+    if (!c->active) compact_begin(w, flags);
+
+    // Entities that need no move still cost a look, so they count too
+    int visited = 0;
+    while (c->cursor < c->order_count && (budget <= 0 || visited < budget)) {
+        compact_entity(w, c->order[c->cursor]);
+        c->cursor++;
+        visited++;
+    }
+    if (c->cursor < c->order_count) return 0;
+
+    // Free lists were kept up to date move by move, they only need putting
+    // back in order so new components fill from the front again
+    for (int i = 0; i < cm->count; i++) {
+        ecs_component_pool_t* pool = &(cm->pools[i]);
+        if (!pool->owners) continue;
+        pool_sort_available(pool);
+        if (c->flags & ECS_COMPACT_SHRINK) compact_shrink(pool);
+    }
+    c->active = 0;
+    return 1;
+}
+
+/*=================================*
+ *            Snapshots            *
+ *=================================*/
+
+typedef struct {
+    int chunk_count;
+    ecs_chunk_t** chunks;
+    int available;
+    int meta_count;
+    ecs_meta_chunk_t** meta;
+} ecs_pool_snapshot_t;
+
+struct ecs_snapshot_t {
+    int entity_count;
+    int component_count;
+    int meta_count;
+    ecs_meta_chunk_t** meta;
+    int fresh;
+    ecs_pool_snapshot_t* pools;
+};
+
+ecs_snapshot_t* ecs_world_clone(ecs_world_t* w) {
+    if (!w) return NULL;
+    ecs_entity_manager_t* em = &(w->entity_manager);
+    ecs_component_manager_t* cm = &(w->component_manager);
+    // Entities still waiting for ecs_sync would be lost on restore
+    entity_publish(w);
+    ecs_snapshot_t* s = ECS_MALLOC(sizeof(*s));
+    s->entity_count = em->count;
+    s->component_count = cm->count;
+
+    // Component chunks are shared, the next write to any of them copies
+    // it; the entity table and slot bookkeeping share the copies made by
+    // earlier clones of chunks nothing wrote to since
+    s->meta_count = em->meta.chunk_count;
+    s->meta = meta_clone(&(em->meta));
+    s->fresh = atomic_load(&(em->fresh));
+
+    s->pools = ECS_MALLOC(sizeof(ecs_pool_snapshot_t) * cm->count);
+    for (int i = 0; i < cm->count; i++) {
+        ecs_component_pool_t* pool = &(cm->pools[i]);
+        ecs_pool_snapshot_t* ps = &(s->pools[i]);
+        ps->chunk_count = pool->chunk_count;
+        ps->chunks = ECS_MALLOC(sizeof(ecs_chunk_t*) * pool->chunk_count);
+        for (int c = 0; c < pool->chunk_count; c++) {
+            ps->chunks[c] = pool->chunks[c];
+            if (ps->chunks[c]) ps->chunks[c]->refs++;
+        }
+        ps->available = pool->available.top;
+        ps->meta_count = pool->meta.chunk_count;
+        ps->meta = meta_clone(&(pool->meta));
+    }
+    return s;
+}
+
+void ecs_world_restore(ecs_world_t* w, ecs_snapshot_t* s) {
+    if (!w || !s) return;
+    ecs_entity_manager_t* em = &(w->entity_manager);
+    ecs_component_manager_t* cm = &(w->component_manager);
+    if (s->entity_count != em->count || s->component_count != cm->count) return;
+
+    // Records keep pointing at their own entity's slots, so they are
+    // restored as they are
+    meta_restore(&(em->meta), s->meta);
+    // Every thread's cached ids go back through the rebuilt free list, so no
+    // other thread may create entities while the world is restored
+    atomic_store(&(em->fresh), s->fresh);
+    entity_rebuild_free_list(w);
+
+    // Queued events describe the state being thrown away
+    for (int i = 0; i < w->observer_manager.count; i++) {
+        observer_reset(&(w->observer_manager.observers[i]));
+    }
+
+    for (int i = 0; i < cm->count; i++) {
+        ecs_component_pool_t* pool = &(cm->pools[i]);
+        ecs_pool_snapshot_t* ps = &(s->pools[i]);
+        for (int c = 0; c < ps->chunk_count; c++) {
+            if (ps->chunks[c]) ps->chunks[c]->refs++;
+        }
+        pool_release(pool);
+        pool->chunk_count = ps->chunk_count;
+        pool->chunks = ECS_MALLOC(sizeof(ecs_chunk_t*) * ps->chunk_count);
+        if (!pool->count) continue;
+
+        memcpy(pool->chunks, ps->chunks, sizeof(ecs_chunk_t*) * ps->chunk_count);
+        meta_restore(&(pool->meta), ps->meta);
+        pool->available.top = ps->available;
+        pool_index_available(pool);
+        pool_rebuild_live(pool);
+        update_filters(w, i);
+    }
+}
+
+void ecs_snapshot_free(ecs_snapshot_t* s) {
+    if (!s) return;
+    for (int i = 0; i < s->component_count; i++) {
+        ecs_pool_snapshot_t* ps = &(s->pools[i]);
+        for (int c = 0; c < ps->chunk_count; c++) chunk_release(ps->chunks[c]);
+        ECS_FREE(ps->chunks);
+        meta_free(ps->meta, ps->meta_count);
+    }
+    ECS_FREE(s->pools);
+    meta_free(s->meta, s->meta_count);
+    ECS_FREE(s);
 }
 
 #endif /* ECS_IMPLEMENTATION */
@@ -0,0 +1,223 @@
+#ifndef _ECS_HPP_
+#define _ECS_HPP_
+
+#include "ecs.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Maps a C++ type to its component index, must be used at global scope
+#define ECS_COMPONENT(type, index) \
+namespace ecs { \
+template<> struct component<type> { static constexpr int id = (index); }; \
+}
+
+namespace ecs {
+
+template<typename T>
+struct component;
+
+template<typename T>
+struct component<const T> : component<T> {};
+
+template<typename... Ts>
+struct mask;
+
+template<>
+struct mask<> {
+    static constexpr unsigned int value = 0;
+};
+
+template<typename T, typename... Ts>
+struct mask<T, Ts...> {
+    static constexpr unsigned int value = (1u << component<T>::id) | mask<Ts...>::value;
+};
+
+// Storage copies components with memcpy into zeroed chunks, snapshots and
+// prefabs share them byte for byte, so only trivially copyable types fit
+template<typename... Ts>
+struct storable : std::true_type {};
+
+template<typename T, typename... Ts>
+struct storable<T, Ts...>
+    : std::integral_constant<bool, std::is_trivially_copyable<T>::value && storable<Ts...>::value> {};
+
+class world {
+public:
+    world(int entities, int components, int systems)
+        : w_(ecs_create(entities, components, systems)) {}
+    ~world() { ecs_destroy(w_); }
+
+    world(const world&) = delete;
+    world& operator=(const world&) = delete;
+
+    ecs_world_t* handle() const { return w_; }
+
+    void update() { ecs_update(w_); }
+
+    template<typename T>
+    void register_component(unsigned int count) {
+        static_assert(storable<T>::value, "components must be trivially copyable");
+        ecs_register_component(w_, component<T>::id, sizeof(T), count);
+    }
+
+    template<typename... Ts>
+    void register_system(ecs_system_func_t fn) {
+        static_assert(sizeof...(Ts) > 0, "a system needs at least one component");
+        int filters[] = { component<Ts>::id... };
+        ecs_register_system(w_, fn, sizeof...(Ts), filters);
+    }
+
+    template<typename... Ts>
+    int register_observer(int events, ecs_observer_func_t fn) {
+        static_assert(sizeof...(Ts) > 0, "an observer needs at least one component");
+        int filters[] = { component<Ts>::id... };
+        return ecs_register_observer(w_, events, fn, sizeof...(Ts), filters);
+    }
+
+    ecs_entity_t create_entity() { return ecs_create_entity(w_); }
+    ecs_entity_t create_prefab() { return ecs_create_prefab(w_); }
+    int instantiate(ecs_entity_t prefab, int count, ecs_entity_t* out = nullptr) {
+        return ecs_instantiate(w_, prefab, count, out);
+    }
+    void destroy_entity(ecs_entity_t e) { ecs_destroy_entity(w_, e); }
+
+    // False when the pool had no slot left, see ecs_entity_set_component
+    template<typename T>
+    bool set(ecs_entity_t e, const T& value) {
+        static_assert(storable<T>::value, "components must be trivially copyable");
+        return ecs_entity_set_component(w_, e, component<T>::id, (void*)&value) != 0;
+    }
+
+    template<typename T>
+    T* get(ecs_entity_t e) {
+        return static_cast<T*>(ecs_entity_get_component(w_, e, component<T>::id));
+    }
+
+    template<typename T>
+    const T* read(ecs_entity_t e) {
+        return static_cast<const T*>(ecs_entity_read_component(w_, e, component<T>::id));
+    }
+
+    template<typename T>
+    void remove(ecs_entity_t e) {
+        ecs_entity_remove_component(w_, e, component<T>::id);
+    }
+
+    // Calls fn(e, Ts&...) for every entity that has all of Ts. Entities come
+    // from a query the world keeps up to date for this mask, and component
+    // strides are resolved at compile time, so the loop body is an indexed
+    // load per component through a chunk table the world reuses. Adding or
+    // removing Ts inside fn changes the list being walked, calling each
+    // again from fn is fine. Chunks of non-const Ts are unshared from
+    // snapshots when the first entity in them is visited, and prefab
+    // components shared with other instances are copied on the way in;
+    // const Ts are read in place.
+    // An entity whose copy can't be made because the pool is full is
+    // skipped, its shared value is left as it was.
+    // Components registered with fields are not laid out as T[], they are
+    // rejected here and have to go through ecs_component_field.
+    template<typename... Ts, typename F>
+    void each(F&& fn) {
+        static_assert(sizeof...(Ts) > 0, "each needs at least one component");
+        static_assert(storable<Ts...>::value, "components must be trivially copyable");
+        for (int fields : { ecs_component_field_count(w_, component<Ts>::id)... }) {
+            assert(!fields && "each can't iterate components registered with fields");
+            if (fields) return;
+        }
+        int q = query<Ts...>();
+        depth guard(depth_);
+        std::tuple<chunks<Ts>...> data{chunks<Ts>(w_, table(guard.level, component<Ts>::id))...};
+        ecs_entity_internal_t* entities = ecs_entities(w_, nullptr);
+        for (int i = 0;; i++) {
+            // fn may register a query, a nested each does, which moves the
+            // filter, so it is looked up again for every entity
+            ecs_filter_t* filter = ecs_query_filter(w_, q);
+            if (i >= filter->entities_count) break;
+            ecs_entity_t e = filter->entities[i];
+            invoke(fn, w_, e, entities[e - 1].components, data, std::index_sequence_for<Ts...>{});
+        }
+    }
+
+private:
+    template<typename T>
+    struct chunks {
+        void** data;
+        const int* shares;
+
+        chunks(ecs_world_t* w, std::vector<void*>& table)
+            : data(table.data()),
+              shares(std::is_const<T>::value ? nullptr : ecs_component_shares(w, component<T>::id)) {
+            // Chunks are fetched as entities reach them, so paged out chunks
+            // nobody visits stay on disk
+            std::fill(table.begin(), table.end(), nullptr);
+        }
+
+        T* at(ecs_world_t* w, ecs_entity_t e, int index) const {
+            if (shares && shares[index] > 1) {
+                return static_cast<T*>(ecs_entity_get_component(w, e, component<T>::id));
+            }
+            void*& chunk = data[index >> ECS_CHUNK_SHIFT];
+            if (!chunk) {
+                chunk = ecs_component_chunk(w, component<T>::id, index >> ECS_CHUNK_SHIFT,
+                                            !std::is_const<T>::value);
+                if (!chunk) return nullptr;
+            }
+            return static_cast<T*>(chunk) + (index & (ECS_CHUNK_SIZE - 1));
+        }
+    };
+
+    // Nested each calls get chunk tables of their own, so an inner loop
+    // can't reset or reallocate the tables an outer one is reading
+    struct depth {
+        int& current;
+        int level;
+        explicit depth(int& d) : current(d), level(d++) {}
+        ~depth() { current--; }
+    };
+
+    // One query per distinct mask, registered the first time it is used
+    template<typename... Ts>
+    int query() {
+        constexpr unsigned int m = mask<Ts...>::value;
+        for (const auto& q : queries_) {
+            if (q.first == m) return q.second;
+        }
+        int filters[] = { component<Ts>::id... };
+        int id = ecs_register_query(w_, sizeof...(Ts), filters);
+        queries_.emplace_back(m, id);
+        return id;
+    }
+
+    std::vector<void*>& table(int level, int comp) {
+        if (tables_.size() <= (std::size_t)level) tables_.resize(level + 1);
+        std::vector<std::vector<void*>>& tables = tables_[level];
+        if (tables.size() <= (std::size_t)comp) tables.resize(comp + 1);
+        tables[comp].resize(ecs_component_chunk_count(w_, comp));
+        return tables[comp];
+    }
+
+    template<typename F, typename... Ts, std::size_t... I>
+    static void invoke(F& fn, ecs_world_t* w, ecs_entity_t e, const int* index,
+                       const std::tuple<chunks<Ts>...>& data, std::index_sequence<I...>) {
+        std::tuple<Ts*...> ptrs{ std::get<I>(data).at(w, e, index[component<Ts>::id])... };
+        for (bool found : { std::get<I>(ptrs) != nullptr... }) {
+            if (!found) return;
+        }
+        fn(e, *std::get<I>(ptrs)...);
+    }
+
+    ecs_world_t* w_;
+    std::vector<std::pair<unsigned int, int>> queries_;
+    std::vector<std::vector<std::vector<void*>>> tables_;
+    int depth_ = 0;
+};
+
+} // namespace ecs
+
+#endif /* _ECS_HPP_ */
@@ -0,0 +1,76 @@
+#define ECS_IMPLEMENTATION
+#include "ecs.h"
+
+#include <assert.h>
+
+enum {
+    POSITION_COMPONENT = 0,
+    VELOCITY_COMPONENT,
+
+    COMPONENTS_COUNT
+};
+
+int main(int argc, char** argv) {
+    ecs_world_t* w = ecs_create(512, COMPONENTS_COUNT, 16);
+    ecs_register_component(w, POSITION_COMPONENT, sizeof(int), 512);
+    ecs_register_component(w, VELOCITY_COMPONENT, sizeof(int), 512);
+
+    ecs_entity_t e[300];
+    for (int i = 0; i < 300; i++) {
+        e[i] = ecs_create_entity(w);
+        ecs_entity_set_component(w, e[i], POSITION_COMPONENT, &i);
+        if (i % 3 == 0) ecs_entity_set_component(w, e[i], VELOCITY_COMPONENT, &i);
+    }
+    // Instances share the prefab's slot, it stays where it is
+    ecs_entity_t prefab = ecs_create_prefab(w);
+    int shared = -1;
+    ecs_entity_set_component(w, prefab, POSITION_COMPONENT, &shared);
+    ecs_entity_t instances[4];
+    ecs_instantiate(w, prefab, 4, instances);
+
+    // Punch holes all over the pools
+    for (int i = 0; i < 300; i += 2) ecs_destroy_entity(w, e[i]);
+    ecs_update(w);
+
+    // The budget is spent on every entity looked at, moved or not
+    int count = 0, visited = 0;
+    ecs_entity_internal_t* entities = ecs_entities(w, &count);
+    for (int i = 0; i < count; i++) visited += entities[i].enabled && entities[i].mask;
+    int steps = 0;
+    while (!ecs_compact(w, 16, ECS_COMPACT_ARCHETYPE | ECS_COMPACT_SHRINK)) steps++;
+    assert(steps == (visited + 15) / 16 - 1);
+
+    const int* prefab_position = ecs_entity_read_component(w, prefab, POSITION_COMPONENT);
+    for (int i = 0; i < 4; i++) {
+        assert(ecs_entity_read_component(w, instances[i], POSITION_COMPONENT) == prefab_position);
+    }
+    assert(*prefab_position == -1);
+
+    for (int i = 1; i < 300; i += 2) {
+        const int* p = ecs_entity_read_component(w, e[i], POSITION_COMPONENT);
+        assert(p && *p == i);
+        const int* v = ecs_entity_read_component(w, e[i], VELOCITY_COMPONENT);
+        assert((i % 3 == 0) ? (v && *v == i) : !v);
+    }
+
+    // 150 positions packed into the front chunks, the tail released
+    int live = 0;
+    int chunks = ecs_component_chunk_count(w, POSITION_COMPONENT);
+    const int* shares = ecs_component_shares(w, POSITION_COMPONENT);
+    for (int c = 0; c < chunks; c++) live += ecs_component_chunk_live(w, POSITION_COMPONENT, c);
+    assert(live == 151);
+    for (int i = 0; i < 150; i++) assert(shares[i] == 1);
+    assert(ecs_component_chunk_live(w, POSITION_COMPONENT, 0) == ECS_CHUNK_SIZE);
+    assert(!ecs_component_chunk(w, POSITION_COMPONENT, chunks - 1, 0));
+
+    // The free list was patched move by move and ends up lowest slot first
+    for (int i = 0; i < 8; i++) {
+        ecs_entity_t fresh = ecs_create_entity(w);
+        ecs_entity_set_component(w, fresh, POSITION_COMPONENT, &i);
+        assert(entities[fresh-1].components[POSITION_COMPONENT] == 150 + i);
+    }
+
+    printf("compact: ok\n");
+    ecs_destroy(w);
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include "ecs.hpp"
+
+#include <cassert>
+#include <cstdio>
+
+struct Position {
+    float x, y;
+};
+
+struct Velocity {
+    float x, y;
+};
+
+struct Health {
+    int hp;
+};
+
+ECS_COMPONENT(Position, 0)
+ECS_COMPONENT(Velocity, 1)
+ECS_COMPONENT(Health, 2)
+
+int main() {
+    ecs::world w(256, 3, 16);
+    w.register_component<Position>(256);
+    w.register_component<Velocity>(256);
+    w.register_component<Health>(256);
+
+    ecs_entity_t e[100];
+    for (int i = 0; i < 100; i++) {
+        e[i] = w.create_entity();
+        w.set(e[i], Position{ (float)i, 0 });
+        if (i % 2) w.set(e[i], Velocity{ 1, 2 });
+    }
+
+    // Nothing is visited before the entities are published
+    int visited = 0;
+    w.each<Position>([&](ecs_entity_t, Position&) { visited++; });
+    assert(visited == 0);
+    w.update();
+
+    w.each<Position, const Velocity>([&](ecs_entity_t, Position& p, const Velocity& v) {
+        p.x += v.x;
+        p.y += v.y;
+        visited++;
+    });
+    assert(visited == 50);
+    for (int i = 0; i < 100; i++) {
+        const Position* p = w.read<Position>(e[i]);
+        assert(p->x == i + (i % 2) && p->y == (i % 2) * 2);
+    }
+
+    // Writes after a snapshot leave the snapshot alone
+    ecs_snapshot_t* s = ecs_world_clone(w.handle());
+    w.each<Position>([](ecs_entity_t, Position& p) { p.y = -1; });
+    ecs_world_restore(w.handle(), s);
+    ecs_snapshot_free(s);
+    w.each<const Position>([](ecs_entity_t, const Position& p) { assert(p.y != -1); });
+
+    // Instances share the prefab's value until each writes its own copy,
+    // the prefab itself is never visited
+    ecs_entity_t prefab = w.create_prefab();
+    w.set(prefab, Velocity{ 5, 5 });
+    ecs_entity_t instances[4];
+    w.instantiate(prefab, 4, instances);
+    w.update();
+    visited = 0;
+    w.each<Velocity>([&](ecs_entity_t, Velocity& v) {
+        v.x = 0;
+        visited++;
+    });
+    assert(visited == 54);
+    assert(w.read<Velocity>(prefab)->x == 5);
+    for (ecs_entity_t i : instances) assert(w.read<Velocity>(i)->x == 0);
+
+    // A nested each registers its query while the outer loop is walking
+    // its own, and reads chunks the outer loop has already fetched
+    for (int i = 0; i < 10; i++) w.set(e[i], Health{ i });
+    w.update();
+    int pairs = 0;
+    w.each<const Position>([&](ecs_entity_t a, const Position&) {
+        w.each<const Position, Health>([&](ecs_entity_t b, const Position&, Health& h) {
+            if (a == b) pairs += h.hp + 1;
+        });
+    });
+    assert(pairs == 55);
+
+    std::printf("each: ok\n");
+    return 0;
+}
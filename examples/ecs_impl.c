@@ -0,0 +1,3 @@
+// ecs.h implementation for the C++ examples, ecs.h needs a C11 compiler
+#define ECS_IMPLEMENTATION
+#include "ecs.h"
@@ -0,0 +1,100 @@
+#define ECS_IMPLEMENTATION
+#include "ecs.h"
+
+#include <assert.h>
+#include <stddef.h>
+
+enum {
+    PARTICLE_COMPONENT = 0,
+
+    COMPONENTS_COUNT
+};
+
+struct Particle {
+    float x, y;
+    char tag;
+    double age;
+};
+
+int main(int argc, char** argv) {
+    ecs_world_t* w = ecs_create(256, COMPONENTS_COUNT, 16);
+    // Position is interleaved, tag and age get an array each
+    ecs_register_component_fields(w, PARTICLE_COMPONENT, 256, ECS_FIELDS(4,
+        ECS_FIELD(struct Particle, x, 0),
+        ECS_FIELD(struct Particle, y, 0),
+        ECS_FIELD(struct Particle, tag, 1),
+        ECS_FIELD(struct Particle, age, 2)));
+    assert(ecs_component_field_count(w, PARTICLE_COMPONENT) == 4);
+
+    ecs_entity_t e[200];
+    for (int i = 0; i < 200; i++) {
+        e[i] = ecs_create_entity(w);
+        struct Particle p = { i, -i, (char)i, i * 0.5 };
+        ecs_entity_set_component(w, e[i], PARTICLE_COMPONENT, &p);
+    }
+    for (int i = 0; i < 200; i += 3) ecs_destroy_entity(w, e[i]);
+
+    // Fields have no struct to point at, but copy back out as one
+    assert(!ecs_entity_get_component(w, e[1], PARTICLE_COMPONENT));
+    struct Particle p;
+    assert(ecs_entity_copy_component(w, e[1], PARTICLE_COMPONENT, &p));
+    assert(p.x == 1 && p.y == -1 && p.tag == 1 && p.age == 0.5);
+    float* y = ecs_entity_get_field(w, e[2], PARTICLE_COMPONENT, 1);
+    *y = 100;
+    assert(!ecs_entity_get_field(w, e[2], PARTICLE_COMPONENT, 4));
+
+    ecs_entity_t prefab = ecs_create_prefab(w);
+    struct Particle spark = { 0, 0, 's', 10 };
+    ecs_entity_set_component(w, prefab, PARTICLE_COMPONENT, &spark);
+    ecs_entity_t sparks[3];
+    assert(ecs_instantiate(w, prefab, 3, sparks) == 3);
+
+    // Walk the age array of every chunk, skipping empty chunks and free slots
+    const int* shares = ecs_component_shares(w, PARTICLE_COMPONENT);
+    int chunks = ecs_component_chunk_count(w, PARTICLE_COMPONENT);
+    int live = 0;
+    double total = 0;
+    for (int c = 0; c < chunks; c++) {
+        int count = ecs_component_chunk_live(w, PARTICLE_COMPONENT, c);
+        if (!count) continue;
+        int stride = 0;
+        char* age = ecs_component_field(w, PARTICLE_COMPONENT, c, 3, &stride, 1);
+        assert(age && stride == sizeof(double));
+        for (int i = 0; i < ECS_CHUNK_SIZE; i++) {
+            int slot = (c << ECS_CHUNK_SHIFT) + i;
+            if (!shares[slot]) continue;
+            count--;
+            // The prefab's slot, writing it here would age every spark
+            if (shares[slot] > 1) continue;
+            *(double*)(age + i * stride) += 1;
+            total += *(double*)(age + i * stride);
+            live++;
+        }
+        assert(count == 0);
+    }
+    assert(live == 133);
+    // Each spark gets its own copy on the way in
+    for (int i = 0; i < 3; i++) {
+        double* age = ecs_entity_get_field(w, sparks[i], PARTICLE_COMPONENT, 3);
+        *age += i + 1;
+    }
+    for (int i = 0; i < 3; i++) {
+        assert(ecs_entity_copy_component(w, sparks[i], PARTICLE_COMPONENT, &p));
+        assert(p.tag == 's' && p.age == 11 + i);
+    }
+    assert(ecs_entity_copy_component(w, prefab, PARTICLE_COMPONENT, &p));
+    assert(p.age == 10);
+
+    double expected = 0;
+    for (int i = 0; i < 200; i++) {
+        if (i % 3 == 0) continue;
+        expected += i * 0.5 + 1;
+        assert(ecs_entity_copy_component(w, e[i], PARTICLE_COMPONENT, &p));
+        assert(p.x == i && p.y == (i == 2 ? 100 : -i) && p.tag == (char)i && p.age == i * 0.5 + 1);
+    }
+    assert(total == expected);
+
+    printf("fields: ok\n");
+    ecs_destroy(w);
+    return 0;
+}
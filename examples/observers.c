@@ -0,0 +1,128 @@
+#define ECS_IMPLEMENTATION
+#include "ecs.h"
+
+#include <assert.h>
+
+enum {
+    HEALTH_COMPONENT = 0,
+    DEAD_COMPONENT,
+    TEXTURE_COMPONENT,
+
+    COMPONENTS_COUNT
+};
+
+int added, removed, set, deaths;
+struct Texture {
+    int handle;
+    char path[28];
+};
+
+int freed[64], freed_count;
+
+void health_observer(ecs_event_queue_t* queue) {
+    for (int i = 0; i < queue->events_count; i++) {
+        ecs_event_t* ev = &(queue->events[i]);
+        if (ev->type == ECS_EVENT_ADD) added++;
+        if (ev->type == ECS_EVENT_REMOVE) removed++;
+        if (ev->type != ECS_EVENT_SET) continue;
+        set++;
+        const int* health = ecs_entity_read_component(queue->world, ev->entity, HEALTH_COMPONENT);
+        if (*health > 0) continue;
+        // Both of these queue events while this queue is being delivered
+        int revived = 1;
+        ecs_entity_set_component(queue->world, ev->entity, DEAD_COMPONENT, NULL);
+        ecs_entity_set_component(queue->world, ev->entity, HEALTH_COMPONENT, &revived);
+    }
+    // Registering from inside a callback may move the observer array
+    for (int i = 0; i < 8; i++) {
+        int observer = ecs_register_observer(queue->world, ECS_EVENT_ADD, NULL, ECS_MASK(1, DEAD_COMPONENT));
+        ecs_unregister_observer(queue->world, observer);
+    }
+}
+
+void dead_observer(ecs_event_queue_t* queue) {
+    deaths += queue->events_count;
+}
+
+void texture_observer(ecs_event_queue_t* queue) {
+    for (int i = 0; i < queue->events_count; i++) {
+        ecs_event_t* ev = &(queue->events[i]);
+        assert(ev->type == ECS_EVENT_REMOVE && ev->data);
+        freed[freed_count++] = ((const struct Texture*)ev->data)->handle;
+    }
+}
+
+int main(int argc, char** argv) {
+    ecs_world_t* w = ecs_create(64, COMPONENTS_COUNT, 16);
+    ecs_register_component(w, HEALTH_COMPONENT, sizeof(int), 64);
+    ecs_register_component(w, DEAD_COMPONENT, sizeof(int), 64);
+    ecs_register_component(w, TEXTURE_COMPONENT, sizeof(struct Texture), 64);
+
+    int all = ECS_EVENT_ADD | ECS_EVENT_REMOVE | ECS_EVENT_SET;
+    ecs_register_observer(w, all, health_observer, ECS_MASK(1, HEALTH_COMPONENT));
+    int polled = ecs_register_observer(w, ECS_EVENT_ADD, NULL, ECS_MASK(1, HEALTH_COMPONENT));
+    ecs_register_observer(w, ECS_EVENT_ADD, dead_observer, ECS_MASK(1, DEAD_COMPONENT));
+
+    ecs_entity_t e[4];
+    for (int i = 0; i < 4; i++) {
+        e[i] = ecs_create_entity(w);
+        int health = i;
+        ecs_entity_set_component(w, e[i], HEALTH_COMPONENT, &health);
+    }
+    assert(ecs_observer_queue(w, polled)->events_count == 4);
+    ecs_observer_clear(w, polled);
+
+    // e[0] starts dead: the DEAD observer comes later in the same flush,
+    // the revive is queued on the observer being delivered and waits
+    ecs_flush_observers(w);
+    assert(added == 4 && set == 4 && removed == 0 && deaths == 1);
+    ecs_flush_observers(w);
+    assert(set == 5 && deaths == 1);
+    ecs_flush_observers(w);
+    assert(set == 5);
+
+    ecs_snapshot_t* s = ecs_world_clone(w);
+    ecs_destroy_entity(w, e[1]);
+    assert(ecs_observer_queue(w, polled)->events_count == 0);
+    // Restoring drops the REMOVE queued for an entity that is back again
+    ecs_world_restore(w, s);
+    ecs_snapshot_free(s);
+    ecs_flush_observers(w);
+    assert(removed == 0);
+
+    ecs_destroy_entity(w, e[2]);
+    ecs_update(w);
+    assert(removed == 1);
+
+    // The id is reused before the REMOVE is delivered, the event still
+    // carries the texture that was released
+    ecs_register_observer(w, ECS_EVENT_REMOVE, texture_observer, ECS_MASK(1, TEXTURE_COMPONENT));
+    ecs_entity_t t = ecs_create_entity(w);
+    struct Texture texture = { 42, "" };
+    ecs_entity_set_component(w, t, TEXTURE_COMPONENT, &texture);
+    ecs_update(w);
+    ecs_destroy_entity(w, t);
+    ecs_entity_t f = ecs_create_entity(w);
+    assert(f == t);
+    texture.handle = 7;
+    ecs_entity_set_component(w, f, TEXTURE_COMPONENT, &texture);
+    ecs_update(w);
+    assert(freed_count == 1 && freed[0] == 42);
+
+    // Clearing releases everything, enough copies to outgrow the buffer
+    for (int i = 0; i < 40; i++) {
+        ecs_entity_t n = ecs_create_entity(w);
+        texture.handle = 100 + i;
+        ecs_entity_set_component(w, n, TEXTURE_COMPONENT, &texture);
+    }
+    ecs_clear_entities(w);
+    ecs_flush_observers(w);
+    assert(freed_count == 42);
+    int sum = 0;
+    for (int i = 1; i < freed_count; i++) sum += freed[i];
+    assert(sum == 7 + 40 * 100 + 39 * 40 / 2);
+
+    printf("observers: ok\n");
+    ecs_destroy(w);
+    return 0;
+}
@@ -0,0 +1,94 @@
+#define ECS_IMPLEMENTATION
+#include "ecs.h"
+
+#include <assert.h>
+
+enum {
+    POSITION_COMPONENT = 0,
+
+    COMPONENTS_COUNT
+};
+
+struct Position {
+    float x, y;
+};
+
+int oldest(ecs_world_t* w, ecs_page_t* pages, int count) {
+    int pick = 0;
+    for (int i = 1; i < count; i++) {
+        if (pages[i].last_use < pages[pick].last_use) pick = i;
+    }
+    return count ? pick : -1;
+}
+
+void run(ecs_evict_func_t policy) {
+    ecs_world_t* w = ecs_create(1024, COMPONENTS_COUNT, 16);
+    ecs_register_component(w, POSITION_COMPONENT, sizeof(struct Position), 1024);
+    assert(ecs_set_paging(w, "ecs_paging.bin", 2, policy));
+
+    ecs_entity_t e[1024];
+    for (int i = 0; i < 1024; i++) {
+        e[i] = ecs_create_entity(w);
+        struct Position p = { i, 0 };
+        ecs_entity_set_component(w, e[i], POSITION_COMPONENT, &p);
+    }
+
+    for (int frame = 0; frame < 20; frame++) {
+        ecs_update(w);
+        // Every write after the clone copies a chunk, the copies reuse the
+        // file space of the chunks the freed snapshot let go of
+        ecs_snapshot_t* s = ecs_world_clone(w);
+        for (int i = 0; i < 1024; i++) {
+            struct Position* p = ecs_entity_get_component(w, e[i], POSITION_COMPONENT);
+            assert(p->x == i && p->y == frame);
+            p->y++;
+        }
+        ecs_update(w);
+        ecs_snapshot_free(s);
+    }
+
+    ecs_prefetch(w, e[0]);
+    const struct Position* p = ecs_entity_read_component(w, e[1023], POSITION_COMPONENT);
+    assert(p->x == 1023 && p->y == 20);
+    ecs_destroy(w);
+
+    // Twenty generations of copies fit in the space of a few
+    FILE* file = fopen("ecs_paging.bin", "rb");
+    fseek(file, 0, SEEK_END);
+    assert(ftell(file) <= 4 * 1024 * (long)sizeof(struct Position));
+    fclose(file);
+}
+
+void lost_file(void) {
+    ecs_world_t* w = ecs_create(128, COMPONENTS_COUNT, 16);
+    ecs_register_component(w, POSITION_COMPONENT, sizeof(struct Position), 128);
+    assert(ecs_set_paging(w, "ecs_paging.bin", 8, NULL));
+    ecs_entity_t e = ecs_create_entity(w);
+    struct Position p = { 1, 2 };
+    ecs_entity_set_component(w, e, POSITION_COMPONENT, &p);
+    ecs_evict_chunk(w, POSITION_COMPONENT, 0);
+    assert(!ecs_paging_error(w));
+
+    // The page file is cut short behind the world's back
+    fflush(NULL);
+    fclose(fopen("ecs_paging.bin", "wb"));
+    assert(!ecs_entity_read_component(w, e, POSITION_COMPONENT));
+    assert(ecs_paging_error(w));
+    assert(!ecs_paging_error(w));
+    // Nothing is made up, the chunk stays evicted and writes are refused
+    assert(!ecs_component_chunk(w, POSITION_COMPONENT, 0, 0));
+    assert(!ecs_entity_copy_component(w, e, POSITION_COMPONENT, &p));
+    assert(!ecs_entity_set_component(w, e, POSITION_COMPONENT, &p));
+    assert(!ecs_entity_get_component(w, e, POSITION_COMPONENT));
+    assert(ecs_paging_error(w));
+    ecs_destroy(w);
+}
+
+int main(int argc, char** argv) {
+    run(NULL);
+    run(oldest);
+    lost_file();
+    remove("ecs_paging.bin");
+    printf("paging: ok\n");
+    return 0;
+}
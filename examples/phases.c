@@ -0,0 +1,64 @@
+#define ECS_IMPLEMENTATION
+#include "ecs.h"
+
+#include <assert.h>
+
+enum {
+    BODY_COMPONENT = 0,
+    AI_COMPONENT,
+
+    COMPONENTS_COUNT
+};
+
+int physics_runs, ai_runs, render_runs;
+float ai_delta;
+
+void physics_system(ecs_filter_t* filter) {
+    assert(filter->delta > 0.0999f && filter->delta < 0.1001f);
+    physics_runs++;
+}
+
+void ai_system(ecs_filter_t* filter) {
+    ai_delta = filter->delta;
+    ai_runs++;
+}
+
+void render_system(ecs_filter_t* filter) {
+    render_runs++;
+}
+
+int main(int argc, char** argv) {
+    ecs_world_t* w = ecs_create(64, COMPONENTS_COUNT, 16);
+    ecs_register_component(w, BODY_COMPONENT, sizeof(int), 64);
+    ecs_register_component(w, AI_COMPONENT, sizeof(int), 64);
+
+    ecs_register_system(w, physics_system, ECS_MASK(1, BODY_COMPONENT));
+    ecs_register_system(w, ai_system, ECS_MASK(1, AI_COMPONENT));
+    ecs_register_system(w, render_system, ECS_MASK(1, BODY_COMPONENT));
+    ecs_system_set_phase(w, physics_system, ECS_PHASE_FIXED_UPDATE);
+    ecs_system_set_phase(w, render_system, ECS_PHASE_RENDER);
+    ecs_system_set_interval(w, ai_system, 3);
+    ecs_set_fixed_timestep(w, 0.1f);
+
+    ecs_entity_t e = ecs_create_entity(w);
+    ecs_entity_set_component(w, e, BODY_COMPONENT, NULL);
+
+    // 0.25s of frames holds two fixed steps, the rest carries over
+    ecs_progress(w, 0.25f);
+    assert(physics_runs == 2 && render_runs == 1);
+    ecs_progress(w, 0.05f);
+    assert(physics_runs == 3 && render_runs == 2);
+
+    // Nothing matches the AI system yet, so it neither runs nor banks time
+    for (int i = 0; i < 6; i++) ecs_progress(w, 0.01f);
+    assert(ai_runs == 0);
+
+    ecs_entity_set_component(w, e, AI_COMPONENT, NULL);
+    for (int i = 0; i < 6; i++) ecs_progress(w, 0.01f);
+    assert(ai_runs == 2);
+    assert(ai_delta > 0.0299f && ai_delta < 0.0301f);
+
+    printf("phases: ok\n");
+    ecs_destroy(w);
+    return 0;
+}
@@ -0,0 +1,78 @@
+#define ECS_IMPLEMENTATION
+#include "ecs.h"
+
+#include <assert.h>
+
+enum {
+    MESH_COMPONENT = 0,
+    HEALTH_COMPONENT,
+
+    COMPONENTS_COUNT
+};
+
+int visited, added;
+
+void health_system(ecs_filter_t* filter) {
+    visited = filter->entities_count;
+}
+
+void mesh_observer(ecs_event_queue_t* queue) {
+    added += queue->events_count;
+}
+
+int main(int argc, char** argv) {
+    ecs_world_t* w = ecs_create(64, COMPONENTS_COUNT, 16);
+    ecs_register_component(w, MESH_COMPONENT, sizeof(int), 64);
+    // Room for the prefab's own value and two private copies
+    ecs_register_component(w, HEALTH_COMPONENT, sizeof(int), 3);
+    ecs_register_system(w, health_system, ECS_MASK(1, HEALTH_COMPONENT));
+    ecs_register_observer(w, ECS_EVENT_ADD | ECS_EVENT_SET, mesh_observer, ECS_MASK(1, MESH_COMPONENT));
+
+    ecs_entity_t prefab = ecs_create_prefab(w);
+    int mesh = 7, health = 100;
+    ecs_entity_set_component(w, prefab, MESH_COMPONENT, &mesh);
+    ecs_entity_set_component(w, prefab, HEALTH_COMPONENT, &health);
+
+    ecs_entity_t e[8];
+    assert(ecs_instantiate(w, prefab, 8, e) == 8);
+    // Instances only show up once they are published, the prefab never does
+    ecs_run_systems(w, ECS_PHASE_UPDATE, 0);
+    assert(visited == 0);
+    ecs_update(w);
+    ecs_run_systems(w, ECS_PHASE_UPDATE, 0);
+    assert(visited == 8);
+    // Building the prefab fired nothing, each instance reports its ADD
+    assert(added == 8);
+
+    const int* shared = ecs_entity_read_component(w, e[0], HEALTH_COMPONENT);
+    for (int i = 0; i < 8; i++) {
+        assert(ecs_entity_read_component(w, e[i], HEALTH_COMPONENT) == shared);
+        assert(*(const int*)ecs_entity_read_component(w, e[i], MESH_COMPONENT) == 7);
+    }
+
+    // Writing unshares just the instance written to
+    int* own = ecs_entity_get_component(w, e[0], HEALTH_COMPONENT);
+    assert(own && own != shared && *own == 100);
+    *own = 50;
+    health = 25;
+    assert(ecs_entity_set_component(w, e[1], HEALTH_COMPONENT, &health));
+    assert(*shared == 100);
+
+    // The pool is full, the write is refused and the shared value survives
+    health = 0;
+    assert(!ecs_entity_set_component(w, e[2], HEALTH_COMPONENT, &health));
+    assert(!ecs_entity_get_component(w, e[2], HEALTH_COMPONENT));
+    assert(*(const int*)ecs_entity_read_component(w, e[2], HEALTH_COMPONENT) == 100);
+    assert(*(const int*)ecs_entity_read_component(w, prefab, HEALTH_COMPONENT) == 100);
+
+    // Destroying a private copy frees a slot for the next writer
+    ecs_destroy_entity(w, e[0]);
+    assert(ecs_entity_set_component(w, e[2], HEALTH_COMPONENT, &health));
+    assert(*(const int*)ecs_entity_read_component(w, e[2], HEALTH_COMPONENT) == 0);
+    assert(*(const int*)ecs_entity_read_component(w, e[1], HEALTH_COMPONENT) == 25);
+    assert(*(const int*)ecs_entity_read_component(w, e[3], HEALTH_COMPONENT) == 100);
+
+    printf("prefab: ok\n");
+    ecs_destroy(w);
+    return 0;
+}
@@ -0,0 +1,93 @@
+#define ECS_IMPLEMENTATION
+#include "ecs.h"
+
+#include <assert.h>
+
+enum {
+    TRANSFORM_COMPONENT = 0,
+    HEALTH_COMPONENT,
+    UNUSED_COMPONENT,
+
+    COMPONENTS_COUNT
+};
+
+struct Transform {
+    struct { float x, y; } position;
+};
+
+int main(int argc, char** argv) {
+    ecs_world_t* w = ecs_create(256, COMPONENTS_COUNT, 16);
+    ecs_register_component(w, TRANSFORM_COMPONENT, sizeof(struct Transform), 200);
+    ecs_register_component(w, HEALTH_COMPONENT, sizeof(int), 200);
+
+    ecs_entity_t e[100];
+    for (int i = 0; i < 100; i++) {
+        e[i] = ecs_create_entity(w);
+        struct Transform t = { { i, -i } };
+        ecs_entity_set_component(w, e[i], TRANSFORM_COMPONENT, &t);
+        if (i % 2) ecs_entity_set_component(w, e[i], HEALTH_COMPONENT, &i);
+    }
+    ecs_update(w);
+
+    // UNUSED_COMPONENT was never registered, cloning must cope with it
+    ecs_snapshot_t* s = ecs_world_clone(w);
+
+    for (int i = 0; i < 100; i++) {
+        struct Transform* t = ecs_entity_get_component(w, e[i], TRANSFORM_COMPONENT);
+        t->position.x += 1000;
+    }
+    for (int i = 0; i < 50; i++) ecs_destroy_entity(w, e[i]);
+    for (int i = 0; i < 30; i++) {
+        ecs_entity_t n = ecs_create_entity(w);
+        ecs_entity_set_component(w, n, HEALTH_COMPONENT, &i);
+    }
+    ecs_update(w);
+
+    ecs_world_restore(w, s);
+    ecs_snapshot_free(s);
+
+    int count = 0;
+    ecs_entity_internal_t* entities = ecs_entities(w, &count);
+    int alive = 0;
+    for (int i = 0; i < count; i++) alive += entities[i].enabled;
+    assert(alive == 100);
+    for (int i = 0; i < 100; i++) {
+        const struct Transform* t = ecs_entity_read_component(w, e[i], TRANSFORM_COMPONENT);
+        assert(t->position.x == i && t->position.y == -i);
+        const int* health = ecs_entity_read_component(w, e[i], HEALTH_COMPONENT);
+        assert((i % 2) ? (health && *health == i) : !health);
+    }
+
+    // Clones only copy the bookkeeping chunks written since the last one
+    ecs_snapshot_t* first = ecs_world_clone(w);
+    ecs_entity_remove_component(w, e[1], HEALTH_COMPONENT);
+    ecs_entity_set_component(w, e[0], HEALTH_COMPONENT, &count);
+    ecs_snapshot_t* second = ecs_world_clone(w);
+    assert(first->meta[0] != second->meta[0] && first->meta[3] == second->meta[3]);
+    assert(first->pools[HEALTH_COMPONENT].meta[0] != second->pools[HEALTH_COMPONENT].meta[0]);
+    assert(first->pools[TRANSFORM_COMPONENT].meta[0] == second->pools[TRANSFORM_COMPONENT].meta[0]);
+    ecs_destroy_entity(w, e[99]);
+    ecs_update(w);
+
+    ecs_world_restore(w, first);
+    assert(!ecs_entity_read_component(w, e[0], HEALTH_COMPONENT));
+    assert(*(const int*)ecs_entity_read_component(w, e[1], HEALTH_COMPONENT) == 1);
+    assert(entities[e[99]-1].enabled);
+    ecs_world_restore(w, second);
+    assert(*(const int*)ecs_entity_read_component(w, e[0], HEALTH_COMPONENT) == count);
+    assert(!ecs_entity_read_component(w, e[1], HEALTH_COMPONENT));
+    assert(entities[e[99]-1].enabled);
+    ecs_snapshot_free(first);
+    ecs_snapshot_free(second);
+
+    // The restored world keeps handing out ids and clears cleanly
+    ecs_entity_t n = ecs_create_entity(w);
+    assert(n && !ecs_entity_read_component(w, n, TRANSFORM_COMPONENT));
+    ecs_clear_entities(w);
+    entities = ecs_entities(w, &count);
+    for (int i = 0; i < count; i++) assert(!entities[i].enabled);
+
+    printf("snapshot: ok\n");
+    ecs_destroy(w);
+    return 0;
+}
@@ -0,0 +1,102 @@
+#define ECS_IMPLEMENTATION
+#include "ecs.h"
+
+#include <assert.h>
+#include <pthread.h>
+
+#define WORKERS 4
+#define PER_WORKER 200
+
+enum {
+    POSITION_COMPONENT = 0,
+
+    COMPONENTS_COUNT
+};
+
+ecs_world_t* worlds[2];
+ecs_entity_t created[WORKERS][PER_WORKER];
+
+void* worker(void* arg) {
+    ecs_entity_t* out = arg;
+    for (int i = 0; i < PER_WORKER; i++) {
+        // Hopping between worlds must not lose the ids cached for either
+        ecs_entity_t other = ecs_create_entity(worlds[1]);
+        assert(other);
+        out[i] = ecs_create_entity(worlds[0]);
+        // The later set wins
+        int position = i;
+        ecs_entity_set_component_deferred(worlds[0], out[i], POSITION_COMPONENT, &position);
+        position = i + 1000;
+        ecs_entity_set_component_deferred(worlds[0], out[i], POSITION_COMPONENT, &position);
+        if (i % 4 == 0) {
+            ecs_destroy_entity_deferred(worlds[0], out[i]);
+            ecs_destroy_entity_deferred(worlds[0], out[i]);
+        }
+    }
+    ecs_flush_entity_cache(worlds[0]);
+    ecs_flush_entity_cache(worlds[1]);
+    return NULL;
+}
+
+int counted;
+
+void count_system(ecs_filter_t* filter) {
+    counted = filter->entities_count;
+}
+
+int main(int argc, char** argv) {
+    worlds[0] = ecs_create(WORKERS * PER_WORKER, COMPONENTS_COUNT, 16);
+    worlds[1] = ecs_create(WORKERS * PER_WORKER, COMPONENTS_COUNT, 16);
+    ecs_world_t* w = worlds[0];
+    ecs_register_component(w, POSITION_COMPONENT, sizeof(int), WORKERS * PER_WORKER);
+    ecs_register_system(w, count_system, ECS_MASK(1, POSITION_COMPONENT));
+
+    pthread_t threads[WORKERS];
+    for (int i = 0; i < WORKERS; i++) pthread_create(&threads[i], NULL, worker, created[i]);
+    for (int i = 0; i < WORKERS; i++) pthread_join(threads[i], NULL);
+
+    // Every id is handed out once, and none is visible before ecs_sync
+    static char seen[WORKERS * PER_WORKER + 1];
+    int count = 0;
+    ecs_entity_internal_t* entities = ecs_entities(w, &count);
+    for (int t = 0; t < WORKERS; t++) {
+        for (int i = 0; i < PER_WORKER; i++) {
+            ecs_entity_t e = created[t][i];
+            assert(e && !seen[e]);
+            seen[e] = 1;
+            assert(!entities[e-1].enabled && !entities[e-1].mask);
+        }
+    }
+
+    // Queued twice, destroyed once
+    ecs_sync(w);
+    int alive = 0;
+    for (int i = 0; i < count; i++) alive += entities[i].enabled;
+    assert(alive == WORKERS * PER_WORKER * 3 / 4);
+    for (int t = 0; t < WORKERS; t++) {
+        for (int i = 0; i < PER_WORKER; i++) {
+            const int* p = ecs_entity_read_component(w, created[t][i], POSITION_COMPONENT);
+            assert(i % 4 == 0 ? !p : *p == i + 1000);
+        }
+    }
+    ecs_run_systems(w, ECS_PHASE_UPDATE, 0);
+    assert(counted == alive);
+
+    // Sets queued for an entity destroyed before the sync hold on to its
+    // id, the other freed ids are recycled and none leaked to the dropped
+    // caches
+    ecs_entity_t gone = created[0][1];
+    ecs_entity_set_component_deferred(w, gone, POSITION_COMPONENT, &count);
+    ecs_destroy_entity(w, gone);
+    for (int i = 0; i < WORKERS * PER_WORKER / 4; i++) assert(ecs_create_entity(w) != gone);
+    assert(!ecs_create_entity(w));
+    ecs_sync(w);
+    assert(!ecs_entity_read_component(w, gone, POSITION_COMPONENT));
+    assert(ecs_create_entity(w) == gone);
+    ecs_sync(w);
+
+    printf("threads: ok\n");
+    ecs_destroy(worlds[0]);
+    ecs_destroy(worlds[1]);
+    return 0;
+}